@@ -2,9 +2,16 @@ QT += core gui multimedia
 greaterThan(QT_MAJOR_VERSION, 4) : QT += widgets
 
 TEMPLATE = app
-CONFIG += console c++11
+CONFIG += console c++14 thread
 CONFIG -= app_bundle
 
+#CD read-ahead prefaults image pages through io_uring when liburing is installed, and a few threads otherwise
+unix:!macx:packagesExist(liburing) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += liburing
+    DEFINES += HAVE_LIBURING
+}
+
 SOURCES += main.cpp \
     emuwindow.cpp \
     emuthread.cpp \
@@ -17,7 +24,15 @@ SOURCES += main.cpp \
     dma.cpp \
     gpu.cpp \
     cdrom.cpp \
-    gte.cpp
+    gte.cpp \
+    texcache.cpp \
+    threadpool.cpp \
+    scanout.cpp \
+    framelimiter.cpp \
+    opstats.cpp \
+    spu.cpp \
+    discimage.cpp \
+    readahead.cpp
 
 HEADERS += \
     emuwindow.hpp \
@@ -31,4 +46,14 @@ HEADERS += \
     dma.hpp \
     gpu.hpp \
     cdrom.hpp \
-    gte.hpp
+    gte.hpp \
+    texcache.hpp \
+    gp0fifo.hpp \
+    threadpool.hpp \
+    scanout.hpp \
+    framemailbox.hpp \
+    framelimiter.hpp \
+    opstats.hpp \
+    spu.hpp \
+    discimage.hpp \
+    readahead.hpp
@@ -1,9 +1,30 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include "cdrom.hpp"
 #include "emulator.hpp"
 
-CDROM::CDROM(Emulator* e) : e(e)
+//Cycles per sector at single speed, 75 sectors a second
+#define READ_CYCLES (33868800 / 75)
+
+//Setmode bits
+#define MODE_WHOLE_SECTOR (1 << 5)
+#define MODE_DOUBLE_SPEED (1 << 7)
+
+using namespace std;
+
+static uint8_t from_BCD(uint8_t value)
+{
+    return (value >> 4) * 10 + (value & 0xF);
+}
+
+static uint8_t to_BCD(uint8_t value)
+{
+    return ((value / 10) << 4) | (value % 10);
+}
+
+CDROM::CDROM(Emulator* e) : e(e), read_ahead(&disc)
 {
 
 }
@@ -17,6 +38,26 @@ void CDROM::reset()
     cycles_left = 0;
     responses_read = 0;
     cmd = 0;
+    sector = nullptr;
+    sector_size = 0;
+    data_FIFO = nullptr;
+    data_FIFO_size = 0;
+    data_read = 0;
+    mode = 0;
+    seek_lba = 0;
+    read_lba = 0;
+    reading = false;
+    read_cycles_left = 0;
+}
+
+bool CDROM::load_disc(const char* name)
+{
+    reading = false;
+    sector = nullptr;
+    sector_size = 0;
+    load_data_FIFO(false);
+    read_ahead.cancel();
+    return disc.open(name);
 }
 
 void CDROM::run()
@@ -30,6 +71,73 @@ void CDROM::run()
             exec_command();
         }
     }
+    if (reading)
+    {
+        read_cycles_left--;
+        //A sector waits for the last interrupt to be acknowledged
+        if (read_cycles_left <= 0 && !int_flag)
+            read_sector();
+    }
+}
+
+uint8_t CDROM::get_stat()
+{
+    //No disc reads as an empty drive with the motor off
+    uint8_t stat = 0;
+    if (disc.is_open())
+        stat |= 1 << 1;
+    if (reading)
+        stat |= 1 << 5;
+    return stat;
+}
+
+void CDROM::read_sector()
+{
+    if (read_lba >= disc.get_end())
+    {
+        printf("[CDROM] Read past the end of the disc\n");
+        reading = false;
+        response[0] = get_stat() | 0x1;
+        response[1] = 0x10;
+        response_size = 2;
+        responses_read = 0;
+        int_check(0x5);
+        return;
+    }
+
+    //The data FIFO gets a view of the sector, not a copy
+    if (mode & MODE_WHOLE_SECTOR)
+    {
+        sector = disc.read_raw(read_lba) + 12;
+        sector_size = RAW_SECTOR_SIZE - 12;
+    }
+    else
+    {
+        sector = disc.read_data(read_lba);
+        sector_size = DATA_SECTOR_SIZE;
+    }
+    read_lba++;
+    read_ahead.prefetch(read_lba);
+    read_cycles_left += (mode & MODE_DOUBLE_SPEED) ? READ_CYCLES / 2 : READ_CYCLES;
+
+    response[0] = get_stat();
+    response_size = 1;
+    responses_read = 0;
+    int_check(0x1);
+}
+
+//The status byte as the first response, and again with second_int when the command finishes
+void CDROM::stat_response(uint8_t second_int)
+{
+    response[0] = get_stat();
+    response_size = 1;
+    if (second_int)
+    {
+        response[1] = get_stat();
+        second_int_flag = second_int;
+        second_response_size = 1;
+    }
+    int_check(0x3);
 }
 
 void CDROM::exec_command()
@@ -39,38 +147,134 @@ void CDROM::exec_command()
     {
         case 0x01:
             printf("[CDROM] GetStat\n");
-            response[0] = 0;
-            response_size = 1;
+            stat_response(0);
+            break;
+        case 0x02:
+            printf("[CDROM] Setloc: %02X:%02X:%02X\n", params[0], params[1], params[2]);
+            seek_lba = (from_BCD(params[0]) * 60 + from_BCD(params[1])) * 75 + from_BCD(params[2]) - 150;
+            stat_response(0);
+            break;
+        case 0x06:
+        case 0x1B:
+            printf("[CDROM] Read%c from %d\n", (cmd == 0x06) ? 'N' : 'S', seek_lba);
+            read_lba = seek_lba;
+            reading = true;
+            read_cycles_left = (mode & MODE_DOUBLE_SPEED) ? READ_CYCLES / 2 : READ_CYCLES;
+            read_ahead.prefetch(read_lba);
+            stat_response(0);
+            break;
+        case 0x08:
+            printf("[CDROM] Stop\n");
+            reading = false;
+            stat_response(0x2);
+            break;
+        case 0x09:
+            printf("[CDROM] Pause\n");
+            //The first response still shows the drive reading
+            stat_response(0);
+            reading = false;
+            response[1] = get_stat();
+            second_int_flag = 0x2;
+            second_response_size = 1;
+            break;
+        case 0x0A:
+            printf("[CDROM] Init\n");
+            mode = 0;
+            reading = false;
+            stat_response(0x2);
+            break;
+        case 0x0B:
+            printf("[CDROM] Mute\n");
+            stat_response(0);
+            break;
+        case 0x0C:
+            printf("[CDROM] Demute\n");
+            stat_response(0);
+            break;
+        case 0x0D:
+            printf("[CDROM] Setfilter\n");
+            stat_response(0);
+            break;
+        case 0x0E:
+            printf("[CDROM] Setmode: $%02X\n", params[0]);
+            mode = params[0];
+            stat_response(0);
+            break;
+        case 0x13:
+            printf("[CDROM] GetTN\n");
+            response[0] = get_stat();
+            response[1] = to_BCD(1);
+            response[2] = to_BCD(max(disc.get_track_count(), 1));
+            response_size = 3;
+            int_check(0x3);
+            break;
+        case 0x14:
+        {
+            printf("[CDROM] GetTD: %02X\n", params[0]);
+            uint8_t m, s, f;
+            DiscImage::lba_to_MSF(disc.get_track_start(from_BCD(params[0])), m, s, f);
+            response[0] = get_stat();
+            response[1] = to_BCD(m);
+            response[2] = to_BCD(s);
+            response_size = 3;
             int_check(0x3);
             break;
+        }
+        case 0x15:
+        case 0x16:
+            printf("[CDROM] Seek%c to %d\n", (cmd == 0x15) ? 'L' : 'P', seek_lba);
+            reading = false;
+            read_lba = seek_lba;
+            //A seek is almost always followed by a read from there
+            read_ahead.prefetch(read_lba);
+            stat_response(0x2);
+            break;
         case 0x19:
             printf("[CDROM] Test: $%02X\n", params[0]);
             exec_test();
             break;
         case 0x1A:
             printf("[CDROM] GetID\n");
-            //Disk not in tray
-            response[0] = 0;
-            response[1] = 0x08;
-            response[2] = 0x40;
-            response[3] = 0x00;
-            response[4] = 0x00;
-            response[5] = 0x00;
-            response[6] = 0x00;
-            response[7] = 0x00;
-            response[8] = 0x00;
-            response_size = 1;
-            second_int_flag = 0x5;
-            second_response_size = 8;
-            int_check(0x3);
+            exec_get_ID();
+            break;
+        case 0x1E:
+            printf("[CDROM] ReadTOC\n");
+            stat_response(0x2);
             break;
         default:
             printf("[CDROM] Unrecognized command $%02X\n", cmd);
             exit(1);
     }
+    param_count = 0;
     busy = false;
 }
 
+void CDROM::exec_get_ID()
+{
+    response[0] = get_stat();
+    response_size = 1;
+    second_response_size = 8;
+    if (!disc.is_open())
+    {
+        //Disk not in tray
+        response[1] = 0x08;
+        response[2] = 0x40;
+        memset(&response[3], 0, 6);
+        second_int_flag = 0x5;
+    }
+    else
+    {
+        //Licensed Mode 2 disc; the region string has to match the BIOS for it to boot
+        response[1] = get_stat();
+        response[2] = 0x00;
+        response[3] = 0x20;
+        response[4] = 0x00;
+        memcpy(&response[5], "SCEA", 4);
+        second_int_flag = 0x2;
+    }
+    int_check(0x3);
+}
+
 void CDROM::exec_test()
 {
     switch (params[0])
@@ -96,12 +300,45 @@ void CDROM::int_check(uint8_t interrupt)
         e->request_IRQ(2);
 }
 
+void CDROM::load_data_FIFO(bool want_data)
+{
+    data_read = 0;
+    if (want_data && sector)
+    {
+        data_FIFO = sector;
+        data_FIFO_size = sector_size;
+    }
+    else
+    {
+        data_FIFO = nullptr;
+        data_FIFO_size = 0;
+    }
+}
+
+void CDROM::read_data_block(uint8_t* dest, int bytes)
+{
+    int available = min(bytes, data_FIFO_size - data_read);
+    if (available > 0)
+    {
+        memcpy(dest, data_FIFO + data_read, available);
+        data_read += available;
+    }
+    else
+        available = 0;
+    if (available < bytes)
+    {
+        printf("[CDROM] Data FIFO underrun: %d of %d bytes\n", available, bytes);
+        memset(dest + available, 0, bytes - available);
+    }
+}
+
 uint8_t CDROM::read_reg1()
 {
     uint8_t reg = reg_index;
     reg |= !param_count << 3;
     reg |= (param_count == 16) << 4;
     reg |= !response_size << 5;
+    reg |= (data_read < data_FIFO_size) << 6;
     reg |= busy << 7;
     printf("[CDROM] Read reg1: $%02X\n", reg);
     return reg;
@@ -130,11 +367,27 @@ uint8_t CDROM::read_reg2()
     return value;
 }
 
+uint8_t CDROM::read_reg3()
+{
+    //Manual reads of the data FIFO, for software that doesn't use DMA
+    uint8_t value = 0;
+    if (data_read < data_FIFO_size)
+    {
+        value = data_FIFO[data_read];
+        data_read++;
+    }
+    return value;
+}
+
 uint8_t CDROM::read_reg4()
 {
     printf("[CDROM] Read reg4: %d", reg_index);
     switch (reg_index)
     {
+        case 0x0:
+        case 0x2:
+            printf("[CDROM] Int enable\n");
+            return int_enable | 0xE0;
         case 0x1:
         case 0x3:
             printf("[CDROM] Int flag\n");
@@ -168,6 +421,10 @@ void CDROM::write_reg2(uint8_t value)
                 second_response_size = 0;
             }
             break;
+        case 0x3:
+            //CD audio volumes aren't used until there is audio output
+            printf("[CDROM] Right to right volume\n");
+            break;
         default:
             printf("[CDROM] Unrecognized reg2 index %d\n", reg_index);
             exit(1);
@@ -181,13 +438,22 @@ void CDROM::write_reg3(uint8_t value)
     {
         case 0x0:
             printf("[CDROM] Write param FIFO\n");
-            params[param_count] = value;
-            param_count++;
+            if (param_count < 16)
+            {
+                params[param_count] = value;
+                param_count++;
+            }
             break;
         case 0x1:
             printf("[CDROM] Int enable\n");
             int_enable = value & 0x1F;
             break;
+        case 0x2:
+            printf("[CDROM] Left to left volume\n");
+            break;
+        case 0x3:
+            printf("[CDROM] Right to left volume\n");
+            break;
         default:
             printf("[CDROM] Unrecognized reg3 index %d\n", reg_index);
             exit(1);
@@ -199,12 +465,22 @@ void CDROM::write_reg4(uint8_t value)
     printf("[CDROM] Write reg4: $%02X\n", value);
     switch (reg_index)
     {
+        case 0x0:
+            printf("[CDROM] Request\n");
+            load_data_FIFO(value & (1 << 7));
+            break;
         case 0x1:
             printf("[CDROM] Int flag\n");
             int_flag &= ~value;
             if (value & (1 << 6)) //Reset param FIFO
                 param_count = 0;
             break;
+        case 0x2:
+            printf("[CDROM] Left to right volume\n");
+            break;
+        case 0x3:
+            printf("[CDROM] Apply volume changes\n");
+            break;
         default:
             printf("[CDROM] Unrecognized reg4 index %d\n", reg_index);
             exit(1);
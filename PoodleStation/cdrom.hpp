@@ -1,6 +1,8 @@
 #ifndef CDROM_HPP
 #define CDROM_HPP
 #include <cstdint>
+#include "discimage.hpp"
+#include "readahead.hpp"
 
 class Emulator;
 
@@ -24,15 +26,39 @@ class CDROM
         uint8_t cmd;
         int cycles_left;
 
+        DiscImage disc;
+        ReadAhead read_ahead;
+        uint8_t mode;
+        int32_t seek_lba; //Set by Setloc
+        int32_t read_lba;
+        bool reading;
+        int read_cycles_left;
+
+        //The last sector the drive read, and the data FIFO loaded from it. Both point into the sector's
+        //source rather than holding a copy, so its bytes are only copied once, on their way into RAM.
+        const uint8_t* sector;
+        int sector_size;
+        const uint8_t* data_FIFO;
+        int data_FIFO_size;
+        int data_read;
+
+        uint8_t get_stat();
+        void stat_response(uint8_t second_int);
         void exec_command();
         void exec_test();
+        void exec_get_ID();
+        void read_sector();
         void int_check(uint8_t interrupt);
+        void load_data_FIFO(bool want_data);
     public:
         CDROM(Emulator* e);
 
         void reset();
         void run();
 
+        //The disc stays in the drive across resets
+        bool load_disc(const char* name);
+
         uint8_t read_reg1();
         uint8_t read_reg2();
         uint8_t read_reg3();
@@ -42,6 +68,9 @@ class CDROM
         void write_reg2(uint8_t value);
         void write_reg3(uint8_t value);
         void write_reg4(uint8_t value);
+
+        //Drains up to bytes from the data FIFO into dest for DMA, padding with zeroes once it runs dry
+        void read_data_block(uint8_t* dest, int bytes);
 };
 
 #endif // CDROM_HPP
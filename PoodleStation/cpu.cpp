@@ -7,7 +7,7 @@
 
 CPU::CPU(Emulator* e) : e(e)
 {
-
+    op_stats = nullptr;
 }
 
 const char* CPU::REG(int id)
@@ -29,6 +29,7 @@ const char* CPU::REG(int id)
 void CPU::reset()
 {
     cop0.reset();
+    gte.reset();
     PC = 0xBFC00000;
     gpr[0] = 0;
     load_delay = 0;
@@ -58,6 +59,8 @@ void CPU::run()
         printf("[CPU] [$%08X] $%08X - %s\n", PC, instr, Disasm::disasm_instr(instr, PC).c_str());
         //print_state();
     }
+    if (op_stats)
+        op_stats->count(instr);
     Interpreter::interpret(*this, instr);
 
     if (inc_PC)
@@ -111,6 +114,11 @@ void CPU::set_disassembly(bool dis)
     can_disassemble = dis;
 }
 
+void CPU::set_op_stats(OpcodeStats* stats)
+{
+    op_stats = stats;
+}
+
 void CPU::jp(uint32_t addr)
 {
     if (!will_branch)
@@ -185,6 +193,9 @@ void CPU::mfc(int cop_id, int cop_reg, int reg)
         case 0:
             set_gpr(reg, cop0.mfc(cop_reg));
             break;
+        case 2:
+            set_gpr(reg, gte.mfc(cop_reg));
+            break;
         default:
             printf("\n[CPU] MFC: Unknown COP%d", cop_id);
             exit(1);
@@ -199,12 +210,28 @@ void CPU::mtc(int cop_id, int cop_reg, int reg)
         case 0:
             cop0.mtc(cop_reg, bark);
             break;
+        case 2:
+            gte.mtc(cop_reg, bark);
+            break;
         default:
             printf("[CPU] MTC: Unknown COP%d\n", cop_id);
             exit(1);
     }
 }
 
+void CPU::cfc(int cop_id, int cop_reg, int reg)
+{
+    switch (cop_id)
+    {
+        case 2:
+            set_gpr(reg, gte.cfc(cop_reg));
+            break;
+        default:
+            printf("[CPU] CFC: Unknown COP%d\n", cop_id);
+            exit(1);
+    }
+}
+
 void CPU::ctc(int cop_id, int cop_reg, int reg)
 {
     uint32_t bark = get_gpr(reg);
@@ -219,6 +246,38 @@ void CPU::ctc(int cop_id, int cop_reg, int reg)
     }
 }
 
+void CPU::lwc(int cop_id, int cop_reg, uint32_t addr)
+{
+    uint32_t value = read32(addr);
+    switch (cop_id)
+    {
+        case 2:
+            gte.mtc(cop_reg, value);
+            break;
+        default:
+            printf("[CPU] LWC: Unknown COP%d\n", cop_id);
+            exit(1);
+    }
+}
+
+void CPU::swc(int cop_id, int cop_reg, uint32_t addr)
+{
+    switch (cop_id)
+    {
+        case 2:
+            write32(addr, gte.mfc(cop_reg));
+            break;
+        default:
+            printf("[CPU] SWC: Unknown COP%d\n", cop_id);
+            exit(1);
+    }
+}
+
+void CPU::cop2_command(uint32_t instruction)
+{
+    gte.execute(instruction);
+}
+
 void CPU::rfe()
 {
     cop0.status.KUc = cop0.status.KUp;
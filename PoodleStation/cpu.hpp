@@ -6,6 +6,7 @@
 #include <cstdio>
 #include "cop0.hpp"
 #include "gte.hpp"
+#include "opstats.hpp"
 
 class Emulator;
 
@@ -25,6 +26,9 @@ class CPU
         bool will_branch;
         bool inc_PC;
 
+        //Null unless opcode stats are being collected
+        OpcodeStats* op_stats;
+
         uint32_t translate_addr(uint32_t addr);
     public:
         CPU(Emulator* e);
@@ -34,6 +38,7 @@ class CPU
         void run();
         void print_state();
         void set_disassembly(bool dis);
+        void set_op_stats(OpcodeStats* stats);
 
         void jp(uint32_t addr);
         void branch(bool condition, int32_t offset);
@@ -46,7 +51,11 @@ class CPU
 
         void mfc(int cop_id, int cop_reg, int reg);
         void mtc(int cop_id, int cop_reg, int reg);
+        void cfc(int cop_id, int cop_reg, int reg);
         void ctc(int cop_id, int cop_reg, int reg);
+        void lwc(int cop_id, int cop_reg, uint32_t addr);
+        void swc(int cop_id, int cop_reg, uint32_t addr);
+        void cop2_command(uint32_t instruction);
 
         uint32_t get_PC();
         uint32_t get_gpr(int index);
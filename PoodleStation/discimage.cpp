@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "discimage.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DISC_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const uint8_t SYNC[12] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+
+static uint8_t to_BCD(uint8_t value)
+{
+    return ((value / 10) << 4) | (value % 10);
+}
+
+//"mm:ss:ff" to a sector count
+static int32_t parse_MSF(const string& MSF)
+{
+    int m = 0, s = 0, f = 0;
+    sscanf(MSF.c_str(), "%d:%d:%d", &m, &s, &f);
+    return (m * 60 + s) * 75 + f;
+}
+
+DiscImage::DiscImage()
+{
+    cache = nullptr;
+    use_counter = 0;
+}
+
+DiscImage::~DiscImage()
+{
+    close();
+    if (cache)
+        delete[] cache;
+}
+
+bool DiscImage::open(const char* name)
+{
+    close();
+
+    string file_string = name;
+    string format = file_string.substr(file_string.find_last_of('.') + 1);
+    transform(format.begin(), format.end(), format.begin(), ::tolower);
+
+    bool success;
+    if (format == "cue")
+        success = parse_CUE(name);
+    else if (format == "iso")
+        success = open_single(name, TRACK_MODE1_2048);
+    else
+        success = open_single(name, TRACK_MODE2_2352);
+
+    if (!success)
+    {
+        close();
+        return false;
+    }
+
+    if (!cache)
+        cache = new DiscCacheEntry[DISC_CACHE_ENTRIES];
+    for (int i = 0; i < DISC_CACHE_ENTRIES; i++)
+        cache[i].valid = false;
+    use_counter = 0;
+
+    printf("[Disc] Opened %s: %d tracks, %d sectors\n", name, get_track_count(), get_end());
+    return true;
+}
+
+void DiscImage::close()
+{
+    for (unsigned int i = 0; i < files.size(); i++)
+    {
+#ifdef DISC_MMAP
+        if (files[i].mapped)
+        {
+            munmap(files[i].data, files[i].size);
+            continue;
+        }
+#endif
+        delete[] files[i].data;
+    }
+    files.clear();
+    tracks.clear();
+}
+
+bool DiscImage::is_open()
+{
+    return !tracks.empty();
+}
+
+bool DiscImage::map_file(const string& name)
+{
+    DiscFile file;
+#ifdef DISC_MMAP
+    int fd = ::open(name.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        printf("[Disc] Failed to open %s\n", name.c_str());
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !info.st_size)
+    {
+        printf("[Disc] %s is empty\n", name.c_str());
+        ::close(fd);
+        return false;
+    }
+    file.size = info.st_size;
+
+    //The mapping holds its own reference to the file
+    void* data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        printf("[Disc] Failed to map %s\n", name.c_str());
+        return false;
+    }
+    file.data = (uint8_t*)data;
+    file.mapped = true;
+#else
+    ifstream in(name, ios::binary | ios::in | ios::ate);
+    if (!in.is_open())
+    {
+        printf("[Disc] Failed to open %s\n", name.c_str());
+        return false;
+    }
+    file.size = in.tellg();
+    file.data = new uint8_t[file.size];
+    file.mapped = false;
+    in.seekg(0);
+    in.read((char*)file.data, file.size);
+#endif
+    files.push_back(file);
+    return true;
+}
+
+bool DiscImage::open_single(const char* name, TRACK_TYPE type)
+{
+    if (!map_file(name))
+        return false;
+
+    DiscFile& file = files[0];
+    if (type != TRACK_MODE1_2048)
+    {
+        //Raw images carry their mode in the header; ones that don't divide into raw sectors are cooked
+        if (file.size % RAW_SECTOR_SIZE && !(file.size % DATA_SECTOR_SIZE))
+            type = TRACK_MODE1_2048;
+        else if (file.size >= 16 && !memcmp(file.data, SYNC, sizeof(SYNC)) && file.data[15] == 1)
+            type = TRACK_MODE1_2352;
+    }
+
+    DiscTrack track;
+    track.number = 1;
+    track.type = type;
+    track.sector_size = (type == TRACK_MODE1_2048) ? DATA_SECTOR_SIZE : RAW_SECTOR_SIZE;
+    track.file = 0;
+    track.file_offset = 0;
+    track.first = 0;
+    track.data_first = 0;
+    track.start = 0;
+    track.end = file.size / track.sector_size;
+    tracks.push_back(track);
+    return true;
+}
+
+bool DiscImage::parse_CUE(const char* name)
+{
+    ifstream cue(name);
+    if (!cue.is_open())
+    {
+        printf("[Disc] Failed to open %s\n", name);
+        return false;
+    }
+
+    //File names in the sheet are relative to it
+    string dir = name;
+    size_t slash = dir.find_last_of("/\\");
+    dir = (slash == string::npos) ? "" : dir.substr(0, slash + 1);
+
+    int32_t file_base = 0; //LBA of the current file's first sector
+    int32_t pregap_total = 0; //Sectors added by PREGAP commands, which aren't in any file
+    int32_t track_pregap = 0;
+    string line;
+    while (getline(cue, line))
+    {
+        istringstream words(line);
+        string command;
+        words >> command;
+        transform(command.begin(), command.end(), command.begin(), ::toupper);
+
+        if (command == "FILE")
+        {
+            //The name is usually quoted and may contain spaces
+            string file_name;
+            size_t open_quote = line.find('"');
+            size_t close_quote = line.rfind('"');
+            if (open_quote != string::npos && close_quote > open_quote)
+                file_name = line.substr(open_quote + 1, close_quote - open_quote - 1);
+            else
+                words >> file_name;
+
+            if (!files.empty())
+            {
+                int sector_size = tracks.empty() ? RAW_SECTOR_SIZE : tracks.back().sector_size;
+                file_base += files.back().size / sector_size;
+            }
+            if (!map_file(dir + file_name))
+                return false;
+        }
+        else if (command == "TRACK")
+        {
+            if (files.empty())
+            {
+                printf("[Disc] TRACK before FILE in %s\n", name);
+                return false;
+            }
+
+            DiscTrack track;
+            string type;
+            words >> track.number >> type;
+            transform(type.begin(), type.end(), type.begin(), ::toupper);
+            if (type == "AUDIO")
+                track.type = TRACK_AUDIO;
+            else if (type == "MODE1/2048")
+                track.type = TRACK_MODE1_2048;
+            else if (type == "MODE1/2352")
+                track.type = TRACK_MODE1_2352;
+            else if (type == "MODE2/2352")
+                track.type = TRACK_MODE2_2352;
+            else
+            {
+                printf("[Disc] Unsupported track type %s\n", type.c_str());
+                return false;
+            }
+            track.sector_size = (track.type == TRACK_MODE1_2048) ? DATA_SECTOR_SIZE : RAW_SECTOR_SIZE;
+            track.file = files.size() - 1;
+            track.file_offset = 0;
+            track.first = -1;
+            track.data_first = -1;
+            track.start = -1;
+            track.end = -1;
+            tracks.push_back(track);
+            track_pregap = 0;
+        }
+        else if (command == "PREGAP" && !tracks.empty())
+        {
+            string length;
+            words >> length;
+            track_pregap = parse_MSF(length);
+            pregap_total += track_pregap;
+        }
+        else if (command == "INDEX" && !tracks.empty())
+        {
+            int index;
+            string position;
+            words >> index >> position;
+
+            DiscTrack& track = tracks.back();
+            int32_t offset = parse_MSF(position);
+            int32_t lba = file_base + offset + pregap_total;
+            if (index == 0 || (index == 1 && track.first < 0))
+            {
+                track.first = lba - (index == 1 ? track_pregap : 0);
+                track.data_first = lba;
+                track.file_offset = (uint64_t)offset * track.sector_size;
+            }
+            if (index == 1)
+                track.start = lba;
+        }
+    }
+
+    if (tracks.empty())
+    {
+        printf("[Disc] No tracks in %s\n", name);
+        return false;
+    }
+
+    //A track runs up to the next one in its file, or to the end of the file
+    for (unsigned int i = 0; i < tracks.size(); i++)
+    {
+        DiscTrack& track = tracks[i];
+        if (track.start < 0)
+        {
+            printf("[Disc] Track %d has no INDEX 01\n", track.number);
+            return false;
+        }
+        if (i + 1 < tracks.size() && tracks[i + 1].file == track.file)
+            track.end = tracks[i + 1].first;
+        else
+        {
+            uint64_t file_size = files[track.file].size;
+            uint64_t left = (file_size > track.file_offset) ? file_size - track.file_offset : 0;
+            track.end = track.data_first + left / track.sector_size;
+        }
+    }
+    return true;
+}
+
+int DiscImage::get_track_count()
+{
+    return tracks.size();
+}
+
+//Track 0 is the lead-out
+int32_t DiscImage::get_track_start(int number)
+{
+    if (number < 1 || number > (int)tracks.size())
+        return get_end();
+    return tracks[number - 1].start;
+}
+
+int32_t DiscImage::get_end()
+{
+    if (tracks.empty())
+        return 0;
+    return tracks.back().end;
+}
+
+const DiscTrack* DiscImage::find_track(int32_t lba)
+{
+    for (unsigned int i = 0; i < tracks.size(); i++)
+    {
+        if (lba >= tracks[i].first && lba < tracks[i].end)
+            return &tracks[i];
+    }
+    return nullptr;
+}
+
+const uint8_t* DiscImage::get_file_sector(const DiscTrack* track, int32_t lba)
+{
+    if (!track || lba < track->data_first)
+        return nullptr;
+    const DiscFile& file = files[track->file];
+    uint64_t offset = track->file_offset + (uint64_t)(lba - track->data_first) * track->sector_size;
+    if (offset + track->sector_size > file.size)
+        return nullptr;
+    return file.data + offset;
+}
+
+//Returns the cached copy of lba if there is one, otherwise the least recently used entry, invalidated
+DiscCacheEntry* DiscImage::get_cache_entry(int32_t lba)
+{
+    use_counter++;
+    DiscCacheEntry* oldest = &cache[0];
+    for (int i = 0; i < DISC_CACHE_ENTRIES; i++)
+    {
+        if (cache[i].valid && cache[i].lba == lba)
+        {
+            cache[i].last_used = use_counter;
+            return &cache[i];
+        }
+        if (!cache[i].valid || (oldest->valid && cache[i].last_used < oldest->last_used))
+            oldest = &cache[i];
+    }
+    oldest->valid = false;
+    oldest->lba = lba;
+    oldest->last_used = use_counter;
+    return oldest;
+}
+
+const uint8_t* DiscImage::read_raw(int32_t lba)
+{
+    const DiscTrack* track = find_track(lba);
+    const uint8_t* sector = get_file_sector(track, lba);
+    if (sector && track->sector_size == RAW_SECTOR_SIZE)
+        return sector;
+
+    //Cooked sectors and gaps have to be rebuilt. EDC/ECC is left as zeroes, which the PSX never looks at.
+    //PSX discs are Mode 2 throughout, so an ISO's sectors become Form 1 with an empty subheader, putting the
+    //data at +24 where software reading whole sectors expects it. Only gaps in Mode 1 tracks stay Mode 1.
+    DiscCacheEntry* entry = get_cache_entry(lba);
+    if (entry->valid)
+        return entry->data;
+
+    memset(entry->data, 0, RAW_SECTOR_SIZE);
+    if (!track || track->type != TRACK_AUDIO)
+    {
+        uint8_t m, s, f;
+        lba_to_MSF(lba, m, s, f);
+        memcpy(entry->data, SYNC, sizeof(SYNC));
+        entry->data[12] = to_BCD(m);
+        entry->data[13] = to_BCD(s);
+        entry->data[14] = to_BCD(f);
+        entry->data[15] = (track && track->type == TRACK_MODE1_2352) ? 1 : 2;
+        if (sector)
+            memcpy(entry->data + 24, sector, DATA_SECTOR_SIZE);
+    }
+    entry->valid = true;
+    return entry->data;
+}
+
+const uint8_t* DiscImage::read_data(int32_t lba)
+{
+    const DiscTrack* track = find_track(lba);
+    const uint8_t* sector = get_file_sector(track, lba);
+    if (!sector)
+    {
+        //Gaps are rebuilt in the track's own mode
+        const uint8_t* raw = read_raw(lba);
+        return (track && track->type == TRACK_MODE1_2352) ? raw + 16 : raw + 24;
+    }
+
+    switch (track->type)
+    {
+        case TRACK_MODE1_2352:
+            return sector + 16;
+        case TRACK_MODE2_2352:
+            //Form 1, after the XA subheader
+            return sector + 24;
+        default:
+            return sector;
+    }
+}
+
+const uint8_t* DiscImage::get_mapped_sector(int32_t lba, int& size)
+{
+    const DiscTrack* track = find_track(lba);
+    const uint8_t* sector = get_file_sector(track, lba);
+    if (!sector || !files[track->file].mapped)
+        return nullptr;
+    size = track->sector_size;
+    return sector;
+}
+
+void DiscImage::lba_to_MSF(int32_t lba, uint8_t& m, uint8_t& s, uint8_t& f)
+{
+    //LBA 0 sits after the two second lead-in
+    int32_t sectors = lba + 150;
+    m = sectors / (60 * 75);
+    s = (sectors / 75) % 60;
+    f = sectors % 75;
+}
@@ -0,0 +1,94 @@
+#ifndef DISCIMAGE_HPP
+#define DISCIMAGE_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define RAW_SECTOR_SIZE 2352
+#define DATA_SECTOR_SIZE 2048
+
+//Only cooked sectors, which have to be rebuilt into raw ones, go through the cache
+#define DISC_CACHE_ENTRIES 16
+
+enum TRACK_TYPE
+{
+    TRACK_AUDIO,
+    TRACK_MODE1_2048,
+    TRACK_MODE1_2352,
+    TRACK_MODE2_2352
+};
+
+//A whole image file, memory-mapped where the OS allows it so sectors are read by page faults alone
+struct DiscFile
+{
+    uint8_t* data;
+    uint64_t size;
+    bool mapped;
+};
+
+//LBAs count from the start of track 1's data (MSF 00:02:00). Sectors from first up to data_first are a
+//pregap that isn't in the file and reads back as zeroes.
+struct DiscTrack
+{
+    int number;
+    TRACK_TYPE type;
+    int sector_size;
+    int file;
+    uint64_t file_offset; //of data_first
+    int32_t first;
+    int32_t data_first;
+    int32_t start; //INDEX 01
+    int32_t end;
+};
+
+struct DiscCacheEntry
+{
+    bool valid;
+    int32_t lba;
+    uint32_t last_used;
+    uint8_t data[RAW_SECTOR_SIZE];
+};
+
+//BIN/CUE and ISO images. Sectors come back as pointers straight into the file mapping whenever the image
+//stores them in the form asked for; the pointers stay valid until the image is closed, except for ones into
+//the cache, which stay valid until DISC_CACHE_ENTRIES other sectors have been rebuilt.
+class DiscImage
+{
+    private:
+        std::vector<DiscFile> files;
+        std::vector<DiscTrack> tracks;
+        DiscCacheEntry* cache;
+        uint32_t use_counter;
+
+        bool map_file(const std::string& name);
+        bool parse_CUE(const char* name);
+        bool open_single(const char* name, TRACK_TYPE type);
+
+        const DiscTrack* find_track(int32_t lba);
+        const uint8_t* get_file_sector(const DiscTrack* track, int32_t lba);
+        DiscCacheEntry* get_cache_entry(int32_t lba);
+    public:
+        DiscImage();
+        ~DiscImage();
+
+        bool open(const char* name);
+        void close();
+        bool is_open();
+
+        int get_track_count();
+        int32_t get_track_start(int number);
+        int32_t get_end();
+
+        //All 2352 bytes, sync and header included
+        const uint8_t* read_raw(int32_t lba);
+        //Only the 2048 bytes of user data of a data sector
+        const uint8_t* read_data(int32_t lba);
+
+        //Where a sector sits in a mapped file, for warming the page cache ahead of the drive; null for
+        //gaps and for images that were read into memory
+        const uint8_t* get_mapped_sector(int32_t lba, int& size);
+
+        static void lba_to_MSF(int32_t lba, uint8_t& m, uint8_t& s, uint8_t& f);
+};
+
+#endif // DISCIMAGE_HPP
@@ -1,8 +1,20 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include "cdrom.hpp"
 #include "dma.hpp"
 #include "emulator.hpp"
 #include "gpu.hpp"
+#include "spu.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+//Upper bound on words sent per linked list burst, so a broken (e.g. circular) list can't hang the emulator
+#define LINKED_LIST_BURST 0x10000
 
 static const char* NAMES[] =
 {
@@ -15,7 +27,7 @@ static const char* NAMES[] =
     "OTC"
 };
 
-DMA::DMA(Emulator* e, GPU* gpu) : e(e), gpu(gpu)
+DMA::DMA(Emulator* e, GPU* gpu, CDROM* cdrom, SPU* spu) : e(e), gpu(gpu), cdrom(cdrom), spu(spu)
 {
 
 }
@@ -26,6 +38,7 @@ void DMA::reset(uint8_t* RAM)
     PCR = 0x07654321;
     ICR.MASK = 0;
     ICR.STAT = 0;
+    pending = 0;
 
     for (int i = 0; i < 7; i++)
     {
@@ -33,87 +46,256 @@ void DMA::reset(uint8_t* RAM)
         channels[i].block = 0;
         channels[i].active = false;
         channels[i].busy = false;
+        channels[i].cycles_left = 0;
+        channels[i].burst_left = 0;
+        channels[i].window_left = 0;
     }
 }
 
+//Returns true while the CPU is kept off the bus
 bool DMA::run()
 {
+    //Nothing in flight is by far the common case, and costs a single test
+    if (!pending)
+        return false;
+
+    bool stalled = false;
     for (int i = 0; i < 7; i++)
     {
-        if (PCR & (1 << ((i << 2) + 3)))
+        if (!(pending & (1 << i)))
+            continue;
+
+        DMA_Channel* chan = &channels[i];
+        if (chan->burst_left)
         {
-            if (channels[i].active)
+            chan->burst_left--;
+            chan->cycles_left--;
+            stalled = true;
+        }
+        else
+        {
+            //Chopping window: the CPU has the bus until the next burst
+            chan->window_left--;
+            if (!chan->window_left)
             {
-                switch (i)
-                {
-                    case 2:
-                        process_GPU();
-                        break;
-                    case 6:
-                        process_OTC();
-                        break;
-                }
-                return true;
+                chan->burst_left = min(chan->cycles_left, 1 << chan->chop_dma_size);
+                chan->window_left = 1 << chan->chop_cpu_size;
             }
         }
+
+        if (!chan->cycles_left)
+        {
+            pending &= ~(1 << i);
+            //A linked list cut short by the burst cap carries on from where it stopped
+            if (i == 2 && chan->sync_mode == 2 && !(chan->next_addr & 0x800000))
+                start_transfer(i);
+            else
+                end_transfer(i);
+        }
     }
-    return false;
+    return stalled;
 }
 
-void DMA::process_GPU()
+//Moves a channel's data right away and schedules its completion for when the bus time is up
+void DMA::start_transfer(int index)
+{
+    DMA_Channel* chan = &channels[index];
+    if (!chan->active || (pending & (1 << index)) || !(PCR & (1 << ((index << 2) + 3))))
+        return;
+
+    //Manual sync mode waits for the start trigger; the others start on the device's DMA requests
+    if (chan->sync_mode == 0 && !chan->busy)
+        return;
+
+    int cycles;
+    switch (index)
+    {
+        case 2:
+            cycles = process_GPU();
+            break;
+        case 3:
+            cycles = process_CDROM();
+            break;
+        case 4:
+            cycles = process_SPU();
+            break;
+        case 6:
+            cycles = process_OTC();
+            break;
+        default:
+            printf("[DMA] Unhandled %s transfer\n", NAMES[index]);
+            cycles = 1;
+            break;
+    }
+    if (cycles < 1)
+        cycles = 1;
+
+    chan->cycles_left = cycles;
+    if (chan->chop && chan->sync_mode == 0)
+    {
+        chan->burst_left = min(cycles, 1 << chan->chop_dma_size);
+        chan->window_left = 1 << chan->chop_cpu_size;
+    }
+    else
+    {
+        chan->burst_left = cycles;
+        chan->window_left = 0;
+    }
+    pending |= 1 << index;
+}
+
+//Each function returns the number of cycles its transfer takes on the bus
+int DMA::process_GPU()
 {
     DMA_Channel* GPU_chan = &channels[2];
     switch (GPU_chan->sync_mode)
     {
         case 1: //DMA request mode
-            gpu->write_GP0(*(uint32_t*)&RAM[GPU_chan->addr]);
-            GPU_chan->word_count--;
-            GPU_chan->addr += 4;
-            if (!GPU_chan->word_count)
-                end_transfer(2);
-            break;
-        case 2: //Linked list mode
-            if (!GPU_chan->word_count)
+        {
+            //GPU DMA requests come as fast as the DMA can serve them, so the whole transfer is done at once
+            int count = GPU_chan->word_count;
+            uint32_t addr = GPU_chan->addr & 0x1FFFFC;
+            if (!GPU_chan->step_back && addr + (count * 4) <= 1024 * 1024 * 2)
             {
-                if (GPU_chan->next_addr == 0xFFFFFF)
-                    end_transfer(2);
+                if (GPU_chan->transfer_dir)
+                    gpu->write_GP0_packet((uint32_t*)&RAM[addr], count);
                 else
+                    gpu->read_response_block((uint32_t*)&RAM[addr], count);
+                addr += count * 4;
+            }
+            else
+            {
+                int step = GPU_chan->step_back ? -4 : 4;
+                for (int i = 0; i < count; i++)
                 {
-                    GPU_chan->addr = GPU_chan->next_addr;
-
-                    uint32_t pointer = *(uint32_t*)&RAM[GPU_chan->addr];
-                    //printf("[GPU DMA] Pointer: $%08X\n", pointer);
-                    GPU_chan->next_addr = pointer & 0xFFFFFF;
-                    GPU_chan->word_count = pointer >> 24;
+                    uint32_t* word = (uint32_t*)&RAM[addr & 0x1FFFFC];
+                    if (GPU_chan->transfer_dir)
+                        gpu->write_GP0(*word);
+                    else
+                        *word = gpu->read_response();
+                    addr += step;
                 }
             }
-            else
+            GPU_chan->addr = addr & 0xFFFFFF;
+            GPU_chan->word_count = 0;
+            return count;
+        }
+        case 2: //Linked list mode
+        {
+            //Walk the list in one go, handing each node's packet to the GPU whole. Each header and data word costs a cycle.
+            int cycles = 0;
+            while (cycles < LINKED_LIST_BURST)
             {
-                GPU_chan->word_count--;
-                GPU_chan->addr += 4;
-                uint32_t data = *(uint32_t*)&RAM[GPU_chan->addr];
-                gpu->write_GP0(data);
+                GPU_chan->addr = GPU_chan->next_addr & 0x1FFFFC;
+                uint32_t pointer = *(uint32_t*)&RAM[GPU_chan->addr];
+                //printf("[GPU DMA] Pointer: $%08X\n", pointer);
+                GPU_chan->next_addr = pointer & 0xFFFFFF;
+                int count = pointer >> 24;
+                cycles += count + 1;
+
+                if (GPU_chan->addr + 4 + (count * 4) <= 1024 * 1024 * 2)
+                    gpu->write_GP0_packet((uint32_t*)&RAM[GPU_chan->addr + 4], count);
+                else
+                {
+                    for (int i = 1; i <= count; i++)
+                        gpu->write_GP0(*(uint32_t*)&RAM[(GPU_chan->addr + (i * 4)) & 0x1FFFFC]);
+                }
+
+                if (GPU_chan->next_addr & 0x800000)
+                    break;
             }
-            break;
+            return cycles;
+        }
     }
+    return 0;
 }
 
-void DMA::process_OTC()
+int DMA::process_CDROM()
 {
-    //In OTC, only three bits are writable - 24, 28, 30. Everything else is static
-    DMA_Channel* OTC = &channels[6];
-    OTC->word_count--;
-    if (!OTC->word_count)
+    //The drive only sends data to RAM, copied straight out of its sector in one go
+    DMA_Channel* CD_chan = &channels[3];
+    int count = CD_chan->word_count;
+    uint32_t addr = CD_chan->addr & 0x1FFFFC;
+    int bytes = count * 4;
+    if (addr + bytes <= 1024 * 1024 * 2)
+        cdrom->read_data_block(&RAM[addr], bytes);
+    else
+    {
+        int first = 1024 * 1024 * 2 - addr;
+        cdrom->read_data_block(&RAM[addr], first);
+        cdrom->read_data_block(RAM, bytes - first);
+    }
+    CD_chan->addr = (addr + bytes) & 0xFFFFFF;
+    CD_chan->word_count = 0;
+    return count;
+}
+
+int DMA::process_SPU()
+{
+    //Sound RAM takes DMA as fast as it comes, so the whole transfer is done at once
+    DMA_Channel* SPU_chan = &channels[4];
+    int count = SPU_chan->word_count;
+    uint32_t addr = SPU_chan->addr & 0x1FFFFC;
+    int bytes = count * 4;
+    int first = min(bytes, (int)(1024 * 1024 * 2 - addr));
+    if (SPU_chan->transfer_dir)
+    {
+        spu->write_block(&RAM[addr], first);
+        spu->write_block(RAM, bytes - first);
+    }
+    else
+    {
+        spu->read_block(&RAM[addr], first);
+        spu->read_block(RAM, bytes - first);
+    }
+    SPU_chan->addr = (addr + bytes) & 0xFFFFFF;
+    SPU_chan->word_count = 0;
+    return count;
+}
+
+//Fills words [first, first + count) with their own address minus 4, four at a time where SSE2 is available
+static void link_backwards(uint8_t* RAM, uint32_t first, uint32_t count)
+{
+    uint32_t* dest = (uint32_t*)&RAM[first];
+    uint32_t link = first - 4;
+    uint32_t i = 0;
+#ifdef __SSE2__
+    __m128i links = _mm_setr_epi32(link, link + 4, link + 8, link + 12);
+    __m128i step = _mm_set1_epi32(16);
+    for (; i + 4 <= count; i += 4)
     {
-        *(uint32_t*)&RAM[OTC->addr] = 0xFFFFFF;
-        end_transfer(6);
+        _mm_storeu_si128((__m128i*)&dest[i], links);
+        links = _mm_add_epi32(links, step);
     }
+    link += i * 4;
+#endif
+    for (; i < count; i++, link += 4)
+        dest[i] = link;
+}
+
+int DMA::process_OTC()
+{
+    //Builds an empty ordering table backwards from addr: every entry points at the one below it,
+    //and the lowest one holds the end marker. Done as one ascending pass over the table's memory.
+    DMA_Channel* OTC = &channels[6];
+    int count = OTC->word_count;
+    uint32_t top = OTC->addr & 0x1FFFFC;
+    uint32_t bottom = (top - (count - 1) * 4) & 0x1FFFFC;
+
+    if (bottom <= top)
+        link_backwards(RAM, bottom + 4, count - 1);
     else
     {
-        *(uint32_t*)&RAM[OTC->addr] = OTC->addr - 4;
-        //printf("[OTC] Write $%08X\n", OTC->addr - 4);
-        OTC->addr -= 4;
+        //The table wraps around the end of RAM
+        link_backwards(RAM, bottom + 4, (0x200000 - bottom - 4) / 4);
+        link_backwards(RAM, 0, top / 4 + 1);
+        *(uint32_t*)&RAM[0] = 0x1FFFFC;
     }
+    *(uint32_t*)&RAM[bottom] = 0xFFFFFF;
+
+    OTC->addr = bottom;
+    OTC->word_count = 0;
+    return count;
 }
 
 void DMA::end_transfer(int index)
@@ -189,6 +371,11 @@ void DMA::write_control(int index, uint32_t value)
 
     channels[index].active = value & (1 << 24);
     channels[index].busy = value & (1 << 28);
+
+    //Stopping a channel drops whatever is left of its transfer
+    if (!channels[index].active)
+        pending &= ~(1 << index);
+    start_transfer(index);
 }
 
 uint32_t DMA::read_PCR()
@@ -214,6 +401,10 @@ void DMA::write_PCR(uint32_t value)
 {
     printf("[DMA] Write PCR: $%08X\n", value);
     PCR = value;
+
+    //Channels that were set up while disabled start now
+    for (int i = 0; i < 7; i++)
+        start_transfer(i);
 }
 
 void DMA::write_ICR(uint32_t value)
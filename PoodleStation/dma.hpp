@@ -20,6 +20,12 @@ struct DMA_Channel
     //Internal registers
     int word_count;
     uint32_t next_addr;
+
+    //The data moves as soon as a transfer starts; these count down the bus time it would have taken.
+    //The CPU is stalled during bursts and runs in the windows between them when chopping.
+    int cycles_left;
+    int burst_left;
+    int window_left;
 };
 
 struct DICR
@@ -29,8 +35,10 @@ struct DICR
     uint8_t MASK, STAT;
 };
 
+class CDROM;
 class Emulator;
 class GPU;
+class SPU;
 
 class DMA
 {
@@ -38,16 +46,24 @@ class DMA
         uint8_t* RAM;
         Emulator* e;
         GPU* gpu;
+        CDROM* cdrom;
+        SPU* spu;
         DMA_Channel channels[7];
         uint32_t PCR;
         DICR ICR;
 
-        void process_GPU();
-        void process_OTC();
+        //Channels with a transfer in flight
+        uint8_t pending;
+
+        int process_GPU();
+        int process_CDROM();
+        int process_SPU();
+        int process_OTC();
 
+        void start_transfer(int index);
         void end_transfer(int index);
     public:
-        DMA(Emulator* e, GPU* gpu);
+        DMA(Emulator* e, GPU* gpu, CDROM* cdrom, SPU* spu);
 
         void reset(uint8_t* RAM);
         bool run();
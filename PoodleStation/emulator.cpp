@@ -4,10 +4,11 @@
 #define CYCLES_PER_FRAME 550000
 #define CYCLES_PER_VBLANK CYCLES_PER_FRAME * 0.90
 
-Emulator::Emulator() : cdrom(this), cpu(this), dma(this, &gpu)
+Emulator::Emulator() : cdrom(this), cpu(this), dma(this, &gpu, &cdrom, &spu)
 {
     BIOS = nullptr;
     RAM = nullptr;
+    op_stats_enabled = false;
 }
 
 Emulator::~Emulator()
@@ -25,6 +26,11 @@ void Emulator::load_BIOS(uint8_t *BIOS)
     memcpy(this->BIOS, BIOS, 1024 * 512);
 }
 
+bool Emulator::load_CD(const char* name)
+{
+    return cdrom.load_disc(name);
+}
+
 void Emulator::reset()
 {
     if (!RAM)
@@ -33,6 +39,7 @@ void Emulator::reset()
     cpu.reset();
     dma.reset(RAM);
     gpu.reset();
+    spu.reset();
     timers.reset();
     frames = 0;
 
@@ -59,6 +66,8 @@ void Emulator::run()
         }
     }
     gpu.new_frame();
+    if (op_stats_enabled)
+        op_stats.end_frame();
     frames++;
 }
 
@@ -69,15 +78,65 @@ void Emulator::request_IRQ(int id)
     cpu.interrupt_check(I_STAT & I_MASK);
 }
 
+void Emulator::set_threaded_GPU(bool threaded)
+{
+    gpu.set_threaded(threaded);
+}
+
+void Emulator::set_tiled_GPU(bool tiled)
+{
+    gpu.set_tiled(tiled);
+}
+
 void Emulator::get_resolution(int &w, int &h)
 {
-    w = 640;
-    h = 480;
+    gpu.get_resolution(w, h);
+}
+
+double Emulator::get_field_rate()
+{
+    return gpu.get_field_rate();
+}
+
+void Emulator::set_frame_output(FrameMailbox* mailbox, std::function<void()> frame_ready)
+{
+    gpu.set_frame_output(mailbox, frame_ready);
+}
+
+void Emulator::set_output_size(int w, int h)
+{
+    gpu.set_output_size(w, h);
+}
+
+void Emulator::set_scale_mode(SCALE_MODE mode)
+{
+    gpu.set_scale_mode(mode);
 }
 
-uint32_t* Emulator::get_framebuffer()
+void Emulator::set_skip_frame(bool skip)
 {
-    return gpu.get_framebuffer();
+    gpu.set_skip_frame(skip);
+}
+
+void Emulator::enable_op_stats(const char* csv_name)
+{
+    op_stats.reset();
+    if (csv_name)
+        op_stats.open_CSV(csv_name);
+    op_stats_enabled = true;
+    cpu.set_op_stats(&op_stats);
+}
+
+void Emulator::disable_op_stats()
+{
+    op_stats_enabled = false;
+    cpu.set_op_stats(nullptr);
+    op_stats.close_CSV();
+}
+
+OpcodeStats& Emulator::get_op_stats()
+{
+    return op_stats;
 }
 
 uint8_t Emulator::read8(uint32_t addr)
@@ -96,6 +155,8 @@ uint8_t Emulator::read8(uint32_t addr)
             return cdrom.read_reg1();
         case 0x1F801801:
             return cdrom.read_reg2();
+        case 0x1F801802:
+            return cdrom.read_reg3();
         case 0x1F801803:
             return cdrom.read_reg4();
     }
@@ -111,11 +172,8 @@ uint16_t Emulator::read16(uint32_t addr)
         return *(uint16_t*)&BIOS[addr & 0x7FFFF];
     if (addr >= 0x1F801100 && addr < 0x1F801130)
         return timers.read16(addr);
-    if (addr >= 0x1F801C00 && addr < 0x1F801F00)
-    {
-        printf("[SPU] Read16 $%08X\n", addr);
-        return 0;
-    }
+    if (addr >= 0x1F801C00 && addr < 0x1F802000)
+        return spu.read16(addr);
     switch (addr)
     {
         case 0x1F801044:
@@ -142,6 +200,8 @@ uint32_t Emulator::read32(uint32_t addr)
         return *(uint32_t*)&BIOS[addr & 0x7FFFF];
     if (addr >= 0x1F801100 && addr < 0x1F801130)
         return timers.read16(addr);
+    if (addr >= 0x1F801C00 && addr < 0x1F802000)
+        return spu.read16(addr) | (spu.read16(addr + 2) << 16);
     //printf("[CPU] Read32: $%08X\n", addr);
     switch (addr)
     {
@@ -151,6 +211,10 @@ uint32_t Emulator::read32(uint32_t addr)
             return I_MASK;
         case 0x1F8010A8:
             return dma.read_control(2);
+        case 0x1F8010B8:
+            return dma.read_control(3);
+        case 0x1F8010C8:
+            return dma.read_control(4);
         case 0x1F8010E8:
             return dma.read_control(6);
         case 0x1F8010F0:
@@ -215,9 +279,9 @@ void Emulator::write16(uint32_t addr, uint16_t value)
         timers.write16(addr, value);
         return;
     }
-    if (addr >= 0x1F801C00 && addr < 0x1F801F00)
+    if (addr >= 0x1F801C00 && addr < 0x1F802000)
     {
-        printf("[SPU] Write16 $%08X: $%04X\n", addr, value);
+        spu.write16(addr, value);
         return;
     }
     switch (addr)
@@ -253,6 +317,12 @@ void Emulator::write32(uint32_t addr, uint32_t value)
         timers.write16(addr, value);
         return;
     }
+    if (addr >= 0x1F801C00 && addr < 0x1F802000)
+    {
+        spu.write16(addr, value & 0xFFFF);
+        spu.write16(addr + 2, value >> 16);
+        return;
+    }
     switch (addr)
     {
         case 0x1F801060:
@@ -276,6 +346,24 @@ void Emulator::write32(uint32_t addr, uint32_t value)
         case 0x1F8010A8:
             dma.write_control(2, value);
             return;
+        case 0x1F8010B0:
+            dma.write_addr(3, value);
+            return;
+        case 0x1F8010B4:
+            dma.write_block(3, value);
+            return;
+        case 0x1F8010B8:
+            dma.write_control(3, value);
+            return;
+        case 0x1F8010C0:
+            dma.write_addr(4, value);
+            return;
+        case 0x1F8010C4:
+            dma.write_block(4, value);
+            return;
+        case 0x1F8010C8:
+            dma.write_control(4, value);
+            return;
         case 0x1F8010E0:
             dma.write_addr(6, value);
             return;
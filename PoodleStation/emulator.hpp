@@ -5,6 +5,7 @@
 #include "cpu.hpp"
 #include "dma.hpp"
 #include "gpu.hpp"
+#include "spu.hpp"
 #include "timers.hpp"
 
 class Emulator
@@ -19,21 +20,38 @@ class Emulator
         CPU cpu;
         DMA dma;
         GPU gpu;
+        SPU spu;
         Timers timers;
 
         uint32_t I_STAT, I_MASK;
+
+        OpcodeStats op_stats;
+        bool op_stats_enabled;
     public:
         Emulator();
         ~Emulator();
 
         void load_BIOS(uint8_t* BIOS);
+        bool load_CD(const char* name);
         void reset();
         void run();
 
         void request_IRQ(int id);
 
+        void set_threaded_GPU(bool threaded);
+        void set_tiled_GPU(bool tiled);
+
         void get_resolution(int& w, int& h);
-        uint32_t* get_framebuffer();
+        double get_field_rate();
+        void set_frame_output(FrameMailbox* mailbox, std::function<void()> frame_ready);
+        void set_output_size(int w, int h);
+        void set_scale_mode(SCALE_MODE mode);
+        void set_skip_frame(bool skip);
+
+        //Per-frame opcode and GTE command counts, optionally dumped to a CSV file (csv_name may be null)
+        void enable_op_stats(const char* csv_name);
+        void disable_op_stats();
+        OpcodeStats& get_op_stats();
 
         uint8_t read8(uint32_t addr);
         uint16_t read16(uint32_t addr);
@@ -1,5 +1,4 @@
 #include <cmath>
-#include <chrono>
 #include <fstream>
 
 #include "emuthread.hpp"
@@ -10,6 +9,15 @@ EmuThread::EmuThread()
 {
     abort = false;
     pause_status = 0x0;
+    threaded_GPU_request.store(-1);
+    tiled_GPU_request.store(-1);
+    frameskip.store(false);
+    skipped_frames = 0;
+    turbo.store(false);
+    turbo_frame = 0;
+
+    //Frames are finished on the GPU's scan-out thread, which drops them in the mailbox and lets the window know
+    e.set_frame_output(&frames, [this] { emit frame_ready(); });
 }
 
 void EmuThread::reset()
@@ -32,12 +40,38 @@ void EmuThread::load_ELF(uint8_t *ELF, uint64_t ELF_size)
     load_mutex.unlock();*/
 }
 
-void EmuThread::load_CD(const char* name)
+//Boots the disc through the BIOS
+bool EmuThread::load_CD(const char* name)
 {
-    /*load_mutex.lock();
-    e.reset();
-    e.load_CD(name);
-    load_mutex.unlock();*/
+    emu_mutex.lock();
+    bool success = e.load_CD(name);
+    if (success)
+        e.reset();
+    emu_mutex.unlock();
+    return success;
+}
+
+//These wait for the current frame to finish, so counts always cover whole frames
+void EmuThread::enable_op_stats(const char* csv_name)
+{
+    emu_mutex.lock();
+    e.enable_op_stats(csv_name);
+    emu_mutex.unlock();
+}
+
+void EmuThread::disable_op_stats()
+{
+    emu_mutex.lock();
+    e.disable_op_stats();
+    emu_mutex.unlock();
+}
+
+OpcodeCounts EmuThread::get_op_counts()
+{
+    emu_mutex.lock();
+    OpcodeCounts counts = e.get_op_stats().get_last_frame();
+    emu_mutex.unlock();
+    return counts;
 }
 
 void EmuThread::run()
@@ -51,27 +85,42 @@ void EmuThread::run()
             return;
         }
         else if (pause_status)
+        {
+            emu_mutex.unlock();
             usleep(10000);
+        }
         else
         {
+            apply_requests();
             e.run();
-            int w, h;
-            //e.get_inner_resolution(w, h);
-            e.get_resolution(w, h);
-            emit completed_frame(e.get_framebuffer(), w, h);
-
-            //Update FPS
-            double FPS;
-            do
+            double field_rate = e.get_field_rate();
+            emu_mutex.unlock();
+
+            //Sleep until the next field is due. The limiter and frameskip state belong to this thread, so the
+            //UI can take the emulator while it waits.
+            bool turbo_on = turbo.load();
+            limiter.set_rate(field_rate);
+            limiter.set_limited(!turbo_on);
+            bool on_time = limiter.wait();
+
+            bool skip;
+            if (turbo_on)
+            {
+                turbo_frame = (turbo_frame + 1) % TURBO_PRESENT_INTERVAL;
+                skip = turbo_frame != 0;
+                skipped_frames = 0;
+            }
+            else
             {
-                chrono::system_clock::time_point now = chrono::system_clock::now();
-                chrono::duration<double> elapsed_seconds = now - old_frametime;
-                FPS = 1 / elapsed_seconds.count();
-            } while (FPS > 60.0);
-            old_frametime = chrono::system_clock::now();
-            emit update_FPS((int)round(FPS));
+                //When a frame overran its field, don't draw the next one so the game keeps real-time speed
+                skip = frameskip.load() && !on_time && skipped_frames < MAX_FRAMESKIP;
+                skipped_frames = skip ? skipped_frames + 1 : 0;
+            }
+            emu_mutex.lock();
+            e.set_skip_frame(skip);
+            emu_mutex.unlock();
+            emit update_FPS((int)round(limiter.get_FPS()), limiter.get_speed(), limiter.get_jitter());
         }
-        emu_mutex.unlock();
     }
 }
 
@@ -82,6 +131,53 @@ void EmuThread::shutdown()
     pause_mutex.unlock();
 }
 
+//Settings from the UI are picked up between frames, so the UI never waits for a frame to finish
+void EmuThread::apply_requests()
+{
+    int threaded = threaded_GPU_request.exchange(-1);
+    if (threaded != -1)
+        e.set_threaded_GPU(threaded);
+
+    int tiled = tiled_GPU_request.exchange(-1);
+    if (tiled != -1)
+        e.set_tiled_GPU(tiled);
+}
+
+FrameMailbox* EmuThread::get_frame_mailbox()
+{
+    return &frames;
+}
+
+void EmuThread::set_threaded_GPU(bool threaded)
+{
+    threaded_GPU_request.store(threaded);
+}
+
+void EmuThread::set_tiled_GPU(bool tiled)
+{
+    tiled_GPU_request.store(tiled);
+}
+
+void EmuThread::set_frameskip(bool enabled)
+{
+    frameskip.store(enabled);
+}
+
+void EmuThread::set_turbo(bool enabled)
+{
+    turbo.store(enabled);
+}
+
+void EmuThread::set_output_size(int w, int h)
+{
+    e.set_output_size(w, h);
+}
+
+void EmuThread::set_scale_mode(int mode)
+{
+    e.set_scale_mode((SCALE_MODE)mode);
+}
+
 /*void EmuThread::press_key(PAD_BUTTON button)
 {
     pause_mutex.lock();
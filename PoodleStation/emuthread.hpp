@@ -1,12 +1,13 @@
 #ifndef EMUTHREAD_HPP
 #define EMUTHREAD_HPP
 
-#include <chrono>
+#include <atomic>
 
 #include <QMutex>
 #include <QThread>
 
 #include "emulator.hpp"
+#include "framelimiter.hpp"
 
 enum PAUSE_EVENT
 {
@@ -21,9 +22,28 @@ class EmuThread : public QThread
         bool abort;
         uint32_t pause_status;
         QMutex emu_mutex, load_mutex, pause_mutex;
+
+        //Declared ahead of the emulator so the scan-out thread is gone before the mailbox is
+        FrameMailbox frames;
         Emulator e;
 
-        std::chrono::system_clock::time_point old_frametime;
+        //-1 when there's nothing new from the UI
+        std::atomic<int> threaded_GPU_request;
+        std::atomic<int> tiled_GPU_request;
+
+        void apply_requests();
+
+        FrameLimiter limiter;
+
+        //Frames in a row that may be skipped before one is drawn regardless, so the picture never freezes
+        static const int MAX_FRAMESKIP = 3;
+        std::atomic<bool> frameskip;
+        int skipped_frames;
+
+        //Turbo runs unthrottled and only draws every TURBO_PRESENT_INTERVAL-th frame
+        static const int TURBO_PRESENT_INTERVAL = 4;
+        std::atomic<bool> turbo;
+        int turbo_frame;
     public:
         EmuThread();
 
@@ -31,14 +51,26 @@ class EmuThread : public QThread
 
         void load_BIOS(uint8_t* BIOS);
         void load_ELF(uint8_t* ELF, uint64_t ELF_size);
-        void load_CD(const char* name);
+        bool load_CD(const char* name);
+
+        FrameMailbox* get_frame_mailbox();
+
+        void enable_op_stats(const char* csv_name);
+        void disable_op_stats();
+        OpcodeCounts get_op_counts();
     protected:
         void run() override;
     signals:
-        void completed_frame(uint32_t* buffer, int w, int h);
-        void update_FPS(int FPS);
+        void frame_ready();
+        void update_FPS(int FPS, double speed, double jitter);
     public slots:
         void shutdown();
+        void set_threaded_GPU(bool threaded);
+        void set_tiled_GPU(bool tiled);
+        void set_frameskip(bool enabled);
+        void set_turbo(bool enabled);
+        void set_output_size(int w, int h);
+        void set_scale_mode(int mode);
         //void press_key(PAD_BUTTON button);
         //void release_key(PAD_BUTTON button);
         void pause(PAUSE_EVENT event);
@@ -1,7 +1,9 @@
 #include <cmath>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 
+#include <QActionGroup>
 #include <QPainter>
 #include <QString>
 #include <QVBoxLayout>
@@ -23,6 +25,7 @@ EmuWindow::EmuWindow(QWidget *parent) : QMainWindow(parent)
     old_frametime = chrono::system_clock::now();
     old_update_time = chrono::system_clock::now();
     framerate_avg = 0.0;
+    scale_mode = SCALE_NONE;
 
     QWidget* widget = new QWidget;
     setCentralWidget(widget);
@@ -44,9 +47,8 @@ EmuWindow::EmuWindow(QWidget *parent) : QMainWindow(parent)
     connect(this, SIGNAL(shutdown()), &emuthread, SLOT(shutdown()));
     //connect(this, SIGNAL(press_key(PAD_BUTTON)), &emuthread, SLOT(press_key(PAD_BUTTON)));
     //connect(this, SIGNAL(release_key(PAD_BUTTON)), &emuthread, SLOT(release_key(PAD_BUTTON)));
-    connect(&emuthread, SIGNAL(completed_frame(uint32_t*, int, int)),
-            this, SLOT(draw_frame(uint32_t*, int, int)));
-    connect(&emuthread, SIGNAL(update_FPS(int)), this, SLOT(update_FPS(int)));
+    connect(&emuthread, SIGNAL(frame_ready()), this, SLOT(draw_frame()));
+    connect(&emuthread, SIGNAL(update_FPS(int,double,double)), this, SLOT(update_FPS(int,double,double)));
     emuthread.pause(PAUSE_EVENT::GAME_NOT_LOADED);
 
     emuthread.reset();
@@ -145,10 +147,14 @@ int EmuWindow::load_exec(const char* file_name, bool skip_BIOS)
         delete[] ELF;
         ELF = nullptr;
     }
-    else if (format == ".iso")
+    else if (format == ".iso" || format == ".cue" || format == ".bin")
     {
         exec_file.close();
-        emuthread.load_CD(file_name);
+        if (!emuthread.load_CD(file_name))
+        {
+            printf("Failed to load disc image %s\n", file_name);
+            return 1;
+        }
     }
     else
     {
@@ -177,12 +183,62 @@ void EmuWindow::create_menu()
     file_menu->addAction(load_rom_action);
     file_menu->addAction(load_bios_action);
     file_menu->addAction(exit_action);
+
+    threaded_GPU_action = new QAction(tr("&Threaded GPU"), this);
+    threaded_GPU_action->setCheckable(true);
+    connect(threaded_GPU_action, &QAction::toggled, this, &EmuWindow::toggle_threaded_GPU);
+
+    tiled_GPU_action = new QAction(tr("T&iled rasterization"), this);
+    tiled_GPU_action->setCheckable(true);
+    connect(tiled_GPU_action, &QAction::toggled, this, &EmuWindow::toggle_tiled_GPU);
+
+    frameskip_action = new QAction(tr("Auto &frameskip"), this);
+    frameskip_action->setCheckable(true);
+    connect(frameskip_action, &QAction::toggled, this, &EmuWindow::toggle_frameskip);
+
+    turbo_action = new QAction(tr("T&urbo"), this);
+    turbo_action->setCheckable(true);
+    //Tab would be taken by focus navigation, so turbo goes on a key nothing else claims
+    turbo_action->setShortcut(Qt::Key_F2);
+    connect(turbo_action, &QAction::toggled, this, &EmuWindow::toggle_turbo);
+
+    stretch_action = new QAction(tr("&Stretch"), this);
+    stretch_action->setCheckable(true);
+    stretch_action->setChecked(true);
+
+    integer_scale_action = new QAction(tr("&Integer scaling"), this);
+    integer_scale_action->setCheckable(true);
+
+    bilinear_action = new QAction(tr("&Bilinear filtering"), this);
+    bilinear_action->setCheckable(true);
+
+    scaling_group = new QActionGroup(this);
+    scaling_group->addAction(stretch_action);
+    scaling_group->addAction(integer_scale_action);
+    scaling_group->addAction(bilinear_action);
+    connect(scaling_group, &QActionGroup::triggered, this, &EmuWindow::change_scaling);
+
+    options_menu = menuBar()->addMenu(tr("&Options"));
+    options_menu->addAction(threaded_GPU_action);
+    options_menu->addAction(tiled_GPU_action);
+    options_menu->addAction(frameskip_action);
+    options_menu->addAction(turbo_action);
+    scaling_menu = options_menu->addMenu(tr("&Scaling"));
+    scaling_menu->addAction(stretch_action);
+    scaling_menu->addAction(integer_scale_action);
+    scaling_menu->addAction(bilinear_action);
 }
 
-void EmuWindow::draw_frame(uint32_t *buffer, int w, int h)
+void EmuWindow::draw_frame()
 {
-    if (!buffer)
+    //Signals can pile up while painting is slow; only the newest frame matters, and the rest find nothing new.
+    //The front buffer belongs to the UI thread until the next swap, so final_image can point straight at it.
+    FrameMailbox* frames = emuthread.get_frame_mailbox();
+    if (!frames->acquire())
         return;
+
+    int w, h;
+    uint32_t* buffer = frames->front(w, h);
     final_image = QImage((uint8_t*)buffer, w, h, QImage::Format_RGBA8888);
     update();
 }
@@ -195,7 +251,17 @@ void EmuWindow::paintEvent(QPaintEvent *event)
 
     printf("Draw image!\n");
 
-    painter.drawPixmap(0, 0, QPixmap::fromImage(final_image));
+    //Scaled frames arrive at their final size and only need centering; otherwise stretch over the window
+    if (scale_mode == SCALE_NONE)
+        painter.drawImage(rect(), final_image);
+    else
+        painter.drawImage((width() - final_image.width()) / 2, (height() - final_image.height()) / 2, final_image);
+}
+
+void EmuWindow::resizeEvent(QResizeEvent *event)
+{
+    QMainWindow::resizeEvent(event);
+    emuthread.set_output_size(width(), height());
 }
 
 void EmuWindow::closeEvent(QCloseEvent *event)
@@ -274,17 +340,21 @@ void EmuWindow::keyReleaseEvent(QKeyEvent *event)
     }*/
 }
 
-void EmuWindow::update_FPS(int FPS)
+void EmuWindow::update_FPS(int FPS, double speed, double jitter)
 {
     /*
     Updates window title every second
     Framerate displayed is the average framerate over 1 second
+    Speed is relative to the console's field rate, so it shows how far ahead turbo gets
+    Jitter is how far frames stray from the console's field period on average
     */
     chrono::system_clock::time_point now = chrono::system_clock::now();
     chrono::duration<double> elapsed_update_seconds = now - old_update_time;
     if (elapsed_update_seconds.count() >= 1.0)
     {
-        string new_title = title + " - FPS: " + to_string(FPS);
+        char stats_text[64];
+        snprintf(stats_text, sizeof(stats_text), " - Speed: %.2fx - Jitter: %.2f ms", speed, jitter);
+        string new_title = title + " - FPS: " + to_string(FPS) + stats_text;
         setWindowTitle(QString::fromStdString(new_title));
         old_update_time = chrono::system_clock::now();
     }
@@ -304,15 +374,46 @@ void EmuWindow::contextMenuEvent(QContextMenuEvent* event)
 void EmuWindow::open_file_no_skip()
 {
     emuthread.pause(PAUSE_EVENT::FILE_DIALOG);
-    QString file_name = QFileDialog::getOpenFileName(this, tr("Open Rom"), "", tr("ROM Files (*.elf *.iso)"));
+    QString file_name = QFileDialog::getOpenFileName(this, tr("Open Rom"), "", tr("ROM Files (*.elf *.iso *.cue *.bin)"));
     load_exec(file_name.toStdString().c_str(), false);
     emuthread.unpause(PAUSE_EVENT::FILE_DIALOG);
 }
 
+void EmuWindow::toggle_threaded_GPU(bool checked)
+{
+    emuthread.set_threaded_GPU(checked);
+}
+
+void EmuWindow::toggle_tiled_GPU(bool checked)
+{
+    emuthread.set_tiled_GPU(checked);
+}
+
+void EmuWindow::toggle_frameskip(bool checked)
+{
+    emuthread.set_frameskip(checked);
+}
+
+void EmuWindow::toggle_turbo(bool checked)
+{
+    emuthread.set_turbo(checked);
+}
+
+void EmuWindow::change_scaling(QAction* action)
+{
+    if (action == integer_scale_action)
+        scale_mode = SCALE_INTEGER;
+    else if (action == bilinear_action)
+        scale_mode = SCALE_BILINEAR;
+    else
+        scale_mode = SCALE_NONE;
+    emuthread.set_scale_mode(scale_mode);
+}
+
 void EmuWindow::open_file_skip()
 {
     emuthread.pause(PAUSE_EVENT::FILE_DIALOG);
-    QString file_name = QFileDialog::getOpenFileName(this, tr("Open Rom"), "", tr("ROM Files (*.elf *.iso)"));
+    QString file_name = QFileDialog::getOpenFileName(this, tr("Open Rom"), "", tr("ROM Files (*.elf *.iso *.cue *.bin)"));
     load_exec(file_name.toStdString().c_str(), true);
     emuthread.unpause(PAUSE_EVENT::FILE_DIALOG);
 }
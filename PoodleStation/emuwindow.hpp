@@ -25,6 +25,19 @@ class EmuWindow : public QMainWindow
         QAction* load_bios_action;
         QAction* exit_action;
 
+        QMenu* options_menu;
+        QAction* threaded_GPU_action;
+        QAction* tiled_GPU_action;
+        QAction* frameskip_action;
+        QAction* turbo_action;
+
+        QMenu* scaling_menu;
+        QActionGroup* scaling_group;
+        QAction* stretch_action;
+        QAction* integer_scale_action;
+        QAction* bilinear_action;
+        SCALE_MODE scale_mode;
+
     public:
         explicit EmuWindow(QWidget *parent = nullptr);
         int init(int argc, char** argv);
@@ -33,6 +46,7 @@ class EmuWindow : public QMainWindow
         void create_menu();
 
         void paintEvent(QPaintEvent *event);
+        void resizeEvent(QResizeEvent *event);
         void closeEvent(QCloseEvent *event);
         void keyPressEvent(QKeyEvent *event);
         void keyReleaseEvent(QKeyEvent *event);
@@ -47,10 +61,15 @@ class EmuWindow : public QMainWindow
         //void press_key(PAD_BUTTON button);
         //void release_key(PAD_BUTTON button);
     public slots:
-        void update_FPS(int FPS);
-        void draw_frame(uint32_t* buffer, int w, int h);
+        void update_FPS(int FPS, double speed, double jitter);
+        void draw_frame();
         void open_file_no_skip();
         void open_file_skip();
+        void toggle_threaded_GPU(bool checked);
+        void toggle_tiled_GPU(bool checked);
+        void toggle_frameskip(bool checked);
+        void toggle_turbo(bool checked);
+        void change_scaling(QAction* action);
 };
 
 #endif
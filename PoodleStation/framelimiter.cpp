@@ -0,0 +1,117 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#ifdef __linux__
+#include <cerrno>
+#include <ctime>
+#endif
+#include "framelimiter.hpp"
+
+FrameLimiter::FrameLimiter()
+{
+    set_rate(NTSC_FIELD_RATE);
+    limited = true;
+    reset();
+}
+
+void FrameLimiter::set_rate(double rate)
+{
+    period = (int64_t)(1000000000.0 / rate);
+}
+
+void FrameLimiter::set_limited(bool limited)
+{
+    this->limited = limited;
+}
+
+void FrameLimiter::reset()
+{
+    started = false;
+    frame_time = (double)period;
+    jitter = 0.0;
+}
+
+int64_t FrameLimiter::now()
+{
+#ifdef __linux__
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void FrameLimiter::sleep_until(int64_t time)
+{
+#ifdef __linux__
+    //Absolute deadline, so a signal interrupting the sleep doesn't stretch it
+    timespec ts;
+    ts.tv_sec = time / 1000000000;
+    ts.tv_nsec = time % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+#else
+    int64_t remaining = time - now();
+    if (remaining > 0)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
+#endif
+}
+
+bool FrameLimiter::wait()
+{
+    int64_t current = now();
+    if (!started)
+    {
+        deadline = current;
+        last_frame = current;
+        started = true;
+    }
+
+    if (!limited)
+    {
+        //Keep the deadline current so limiting picks up from here once turned back on
+        deadline = current;
+        frame_time += ((current - last_frame) - frame_time) / 16.0;
+        last_frame = current;
+        return true;
+    }
+
+    deadline += period;
+    bool on_time = current <= deadline;
+    if (current > deadline + period)
+    {
+        //More than a frame behind (slow frame, unpause, debugger...) - start over instead of racing to catch up
+        deadline = current;
+    }
+    else
+    {
+        if (deadline - current > SPIN_MARGIN_NS)
+            sleep_until(deadline - SPIN_MARGIN_NS);
+        while ((current = now()) < deadline);
+    }
+
+    int64_t interval = current - last_frame;
+    last_frame = current;
+
+    int64_t deviation = std::abs(interval - period);
+    frame_time += (interval - frame_time) / 16.0;
+    jitter += (deviation - jitter) / 16.0;
+    return on_time;
+}
+
+double FrameLimiter::get_FPS()
+{
+    return 1000000000.0 / frame_time;
+}
+
+double FrameLimiter::get_speed()
+{
+    return period / frame_time;
+}
+
+double FrameLimiter::get_jitter()
+{
+    return jitter / 1000000.0;
+}
@@ -0,0 +1,46 @@
+#ifndef FRAMELIMITER_HPP
+#define FRAMELIMITER_HPP
+#include <cstdint>
+
+//Field rates from the GPU clock (53.693175 MHz NTSC, 53.203425 MHz PAL) divided by cycles per scanline and scanlines per field
+#define NTSC_FIELD_RATE (53693175.0 / (3413.0 * 263.0))
+#define PAL_FIELD_RATE (53203425.0 / (3406.0 * 314.0))
+
+//Paces the emulation thread to the console's field rate. The bulk of every wait is spent asleep and only
+//the last SPIN_MARGIN_NS is spun out, since the scheduler can wake us up late but never early.
+class FrameLimiter
+{
+    private:
+        static const int64_t SPIN_MARGIN_NS = 300000;
+
+        int64_t period;
+        int64_t deadline;
+        int64_t last_frame;
+        bool started;
+        bool limited;
+
+        //Running averages, in nanoseconds
+        double frame_time;
+        double jitter;
+
+        static int64_t now();
+        static void sleep_until(int64_t time);
+    public:
+        FrameLimiter();
+
+        void set_rate(double rate);
+        //When unlimited, wait() returns right away and only measures how fast frames come
+        void set_limited(bool limited);
+        void reset();
+
+        //Blocks until the next field is due. Returns false if the frame took longer than a field to emulate.
+        bool wait();
+
+        double get_FPS();
+        //Emulation speed relative to the console, 1.0 being full speed
+        double get_speed();
+        //Average deviation of the frame interval from the target period, in milliseconds
+        double get_jitter();
+};
+
+#endif // FRAMELIMITER_HPP
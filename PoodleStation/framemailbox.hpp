@@ -0,0 +1,70 @@
+#ifndef FRAMEMAILBOX_HPP
+#define FRAMEMAILBOX_HPP
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+//Lock-free triple buffer of finished frames between the scan-out thread and the UI.
+//The producer always has a buffer to write to and the consumer always holds a complete frame; the third buffer
+//is swapped between them with a single atomic exchange, so neither side ever waits on the other.
+class FrameMailbox
+{
+    private:
+        static const int FRESH = 0x4; //Set on the shared index when it holds a frame the consumer hasn't seen
+
+        std::vector<uint32_t> buffers[3];
+        int widths[3], heights[3];
+
+        int write_index;
+        int read_index;
+        std::atomic<int> middle;
+    public:
+        FrameMailbox();
+
+        //Producer side
+        uint32_t* begin_write(int w, int h);
+        void publish();
+
+        //Consumer side - swaps in the newest frame if there is one. The old front buffer is given up.
+        bool acquire();
+        uint32_t* front(int& w, int& h);
+};
+
+inline FrameMailbox::FrameMailbox() : write_index(0), read_index(1), middle(2)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        widths[i] = 0;
+        heights[i] = 0;
+    }
+}
+
+inline uint32_t* FrameMailbox::begin_write(int w, int h)
+{
+    buffers[write_index].resize(w * h);
+    widths[write_index] = w;
+    heights[write_index] = h;
+    return buffers[write_index].data();
+}
+
+inline void FrameMailbox::publish()
+{
+    write_index = middle.exchange(write_index | FRESH, std::memory_order_acq_rel) & 0x3;
+}
+
+inline bool FrameMailbox::acquire()
+{
+    if (!(middle.load(std::memory_order_acquire) & FRESH))
+        return false;
+    read_index = middle.exchange(read_index, std::memory_order_acq_rel) & 0x3;
+    return true;
+}
+
+inline uint32_t* FrameMailbox::front(int &w, int &h)
+{
+    w = widths[read_index];
+    h = heights[read_index];
+    return buffers[read_index].data();
+}
+
+#endif // FRAMEMAILBOX_HPP
@@ -0,0 +1,93 @@
+#ifndef GP0FIFO_HPP
+#define GP0FIFO_HPP
+#include <atomic>
+#include <cstdint>
+
+//Packets whose header has this bit set carry CPU->VRAM data rather than a command
+#define GP0_DATA_PACKET 0x80000000
+//Empty packet asking the render thread to finish all binned work
+#define GP0_SYNC_PACKET 0x40000000
+#define GP0_PACKET_SIZE 0x3FFFFFFF
+
+//Single-producer/single-consumer ring of GP0 packets between the emulation thread and the render thread.
+//Each packet is a header word holding the word count, followed by that many words.
+class GP0FIFO
+{
+    private:
+        static const uint32_t SIZE = 1 << 16;
+        static const uint32_t MASK = SIZE - 1;
+
+        uint32_t* buffer;
+        std::atomic<uint32_t> write_pos;
+        std::atomic<uint32_t> read_pos;
+    public:
+        GP0FIFO();
+        ~GP0FIFO();
+
+        static const uint32_t MAX_PACKET = 1024;
+
+        void clear();
+        bool empty() const;
+        uint32_t free_space() const;
+
+        //Producer side - the caller must make sure there is room for count + 1 words
+        void push(uint32_t header, const uint32_t* words, uint32_t count);
+
+        //Consumer side - copies the oldest packet into words and returns its header, without removing it
+        uint32_t front(uint32_t* words) const;
+        void pop();
+};
+
+inline GP0FIFO::GP0FIFO() : write_pos(0), read_pos(0)
+{
+    buffer = new uint32_t[SIZE];
+}
+
+inline GP0FIFO::~GP0FIFO()
+{
+    delete[] buffer;
+}
+
+inline void GP0FIFO::clear()
+{
+    write_pos.store(0);
+    read_pos.store(0);
+}
+
+inline bool GP0FIFO::empty() const
+{
+    return read_pos.load() == write_pos.load();
+}
+
+inline uint32_t GP0FIFO::free_space() const
+{
+    return SIZE - (write_pos.load(std::memory_order_relaxed) - read_pos.load(std::memory_order_acquire));
+}
+
+inline void GP0FIFO::push(uint32_t header, const uint32_t* words, uint32_t count)
+{
+    uint32_t pos = write_pos.load(std::memory_order_relaxed);
+    buffer[pos & MASK] = header;
+    for (uint32_t i = 0; i < count; i++)
+        buffer[(pos + 1 + i) & MASK] = words[i];
+    write_pos.store(pos + 1 + count);
+}
+
+inline uint32_t GP0FIFO::front(uint32_t* words) const
+{
+    uint32_t pos = read_pos.load(std::memory_order_relaxed);
+    uint32_t header = buffer[pos & MASK];
+    uint32_t count = header & GP0_PACKET_SIZE;
+    for (uint32_t i = 0; i < count; i++)
+        words[i] = buffer[(pos + 1 + i) & MASK];
+    return header;
+}
+
+inline void GP0FIFO::pop()
+{
+    uint32_t pos = read_pos.load(std::memory_order_relaxed);
+    uint32_t count = buffer[pos & MASK] & GP0_PACKET_SIZE;
+    read_pos.store(pos + 1 + count);
+}
+
+#endif // GP0FIFO_HPP
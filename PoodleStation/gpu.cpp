@@ -1,8 +1,14 @@
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include "framelimiter.hpp"
 #include "gpu.hpp"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 //#define printf(fmt, ...)(0)
 
 using namespace std;
@@ -21,26 +27,86 @@ void Vertex::set_texcoords(uint32_t param)
     t = (param >> 8) & 0xFF;
 }
 
+//Sizes wrap within VRAM, so a width of 0 means 1024 and a height of 0 means 512
+static void transfer_dimensions(uint32_t value, uint32_t& w, uint32_t& h)
+{
+    w = (((value & 0xFFFF) - 1) & 0x3FF) + 1;
+    h = (((value >> 16) - 1) & 0x1FF) + 1;
+}
+
+//Row kernels for fills and copies, 8 pixels at a time where SSE2 is available
+static void fill_row(uint16_t* dest, uint16_t color, uint32_t count)
+{
+    uint32_t i = 0;
+#ifdef __SSE2__
+    __m128i fill = _mm_set1_epi16(color);
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i*)&dest[i], fill);
+#endif
+    for (; i < count; i++)
+        dest[i] = color;
+}
+
+//Pixels with the mask bit set are left alone when check_mask is on. The source must not overlap dest.
+static void copy_row(uint16_t* dest, const uint16_t* source, uint32_t count, uint16_t set_mask, bool check_mask)
+{
+    if (!set_mask && !check_mask)
+    {
+        memcpy(dest, source, count * sizeof(uint16_t));
+        return;
+    }
+
+    uint32_t i = 0;
+#ifdef __SSE2__
+    __m128i mask = _mm_set1_epi16(set_mask);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i pixels = _mm_or_si128(_mm_loadu_si128((const __m128i*)&source[i]), mask);
+        if (check_mask)
+        {
+            //All ones in lanes whose destination pixel is masked
+            __m128i old = _mm_loadu_si128((const __m128i*)&dest[i]);
+            __m128i keep = _mm_srai_epi16(old, 15);
+            pixels = _mm_or_si128(_mm_and_si128(keep, old), _mm_andnot_si128(keep, pixels));
+        }
+        _mm_storeu_si128((__m128i*)&dest[i], pixels);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        if (!check_mask || !(dest[i] & 0x8000))
+            dest[i] = source[i] | set_mask;
+    }
+}
+
 GPU::GPU()
 {
     VRAM = nullptr;
-    framebuffer = nullptr;
+    threaded = false;
+    render_sleeping.store(false);
+    render_stop = false;
+    tiled = false;
+    batch_pending.store(false);
+    batch_page_count = 0;
+    memset(batch_draw_blocks, 0, sizeof(batch_draw_blocks));
+    memset(batch_tex_blocks, 0, sizeof(batch_tex_blocks));
 }
 
 GPU::~GPU()
 {
+    set_threaded(false);
+    set_tiled(false);
     if (VRAM)
         delete[] VRAM;
-    if (framebuffer)
-        delete[] framebuffer;
 }
 
 void GPU::reset()
 {
+    //The render thread and any binned primitives must be done with the old state before it's cleared
+    sync();
     if (!VRAM)
         VRAM = new uint8_t[1024 * 1024];
-    if (!framebuffer)
-        framebuffer = new uint32_t[640 * 480];
+    tex_cache.reset(VRAM);
     is_odd_frame = false;
     stat.ready_cmd = true;
     stat.ready_DMA = true;
@@ -49,6 +115,24 @@ void GPU::reset()
 
     display_start.x = 0;
     display_start.y = 0;
+    display_enabled = false;
+    display_mode.h_res = 0;
+    display_mode.h_res_368 = false;
+    display_mode.v_res_480 = false;
+    display_mode.PAL = false;
+    display_mode.color_24bit = false;
+    display_mode.interlaced = false;
+    display_range.x1 = 0x200;
+    display_range.x2 = 0x200 + (256 * 10);
+    display_range.y1 = 0x010;
+    display_range.y2 = 0x010 + 240;
+    display_w = 0;
+    display_h = 0;
+    update_display_area();
+    memset(display_dirty, 0, sizeof(display_dirty));
+    full_redraw = true;
+    skip_draw = false;
+    skip_next = false;
 
     draw_mode.texbase_x = 0;
     draw_mode.texbase_y = 0;
@@ -57,8 +141,10 @@ void GPU::reset()
 
     read_transfer = false;
     write_transfer = false;
-    cmd_params = 0;
+    packet_size = 0;
     params_needed = 0;
+    polyline = false;
+    stat_draw_mode = 0;
 }
 
 void GPU::new_frame()
@@ -68,30 +154,122 @@ void GPU::new_frame()
 
 void GPU::render_frame()
 {
+    sync();
     printf("Display start: (%d, %d)\n", display_start.x, display_start.y);
-    for (int y = 0; y < 480; y++)
+
+    //A skipped frame is never shown; the window keeps the last one, and the dirty lines carry over to the next
+    bool skipped = skip_draw;
+    skip_draw = skip_next;
+    if (skipped)
+        return;
+
+    //Only lines of the display area that were drawn to since the last frame are captured for the scan-out thread,
+    //which converts them while the next frame is emulated. If nothing visible changed, nothing is presented.
+    uint32_t line_bytes = display_w * (display_mode.color_24bit ? 3 : 2);
+    uint16_t columns[TEXCACHE_BLOCK_ROWS] = {};
+    TextureCache::mark_blocks(columns, display_start.x, 0, (line_bytes + 1) / 2, 1);
+
+    uint16_t dirty[MAX_DISPLAY_H];
+    bool changed = false;
+    for (int y = 0; y < display_h; y++)
+    {
+        uint32_t pix_y = (display_start.y + y) & 0x1FF;
+        if (full_redraw)
+            dirty[y] = 0xFFFF;
+        else if (!display_enabled)
+            dirty[y] = 0;
+        else
+            dirty[y] = display_dirty[pix_y >> 4] & columns[0];
+
+        //24-bit pixels don't line up with blocks, so any change on the line redoes all of it
+        if (dirty[y] && display_mode.color_24bit)
+            dirty[y] = 0xFFFF;
+        changed |= dirty[y] != 0;
+    }
+
+    if (changed)
     {
-        for (int x = 0; x < 640; x++)
+        DisplaySnapshot& snapshot = scanout.begin_frame();
+        snapshot.w = display_w;
+        snapshot.h = display_h;
+        snapshot.enabled = display_enabled;
+        snapshot.color_24bit = display_mode.color_24bit;
+        snapshot.full = full_redraw;
+        snapshot.start_x = display_start.x;
+        for (int y = 0; y < display_h; y++)
         {
-            int pix_x = x + display_start.x;
-            int pix_y = y + display_start.y;
-            uint32_t final_color = 0xFF000000;
-            if (display_enabled)
-            {
-                uint16_t color = *(uint16_t*)&VRAM[(pix_x + (pix_y * 1024)) * 2];
-                final_color |= (color & 0x1F) << 3;
-                final_color |= ((color >> 5) & 0x1F) << 11;
-                final_color |= ((color >> 10) & 0x1F) << 19;
-            }
+            snapshot.dirty[y] = dirty[y];
+            if (!dirty[y] || !display_enabled)
+                continue;
 
-            framebuffer[x + (y * 640)] = final_color;
+            uint8_t* line = &VRAM[((display_start.y + y) & 0x1FF) * 2048];
+            uint32_t offset = display_start.x * 2;
+            uint32_t first = min(line_bytes, 2048 - offset);
+            memcpy(snapshot.lines[y], &line[offset], first);
+            memcpy(&snapshot.lines[y][first], line, line_bytes - first);
         }
+        scanout.submit();
     }
+
+    memset(display_dirty, 0, sizeof(display_dirty));
+    full_redraw = false;
+}
+
+void GPU::update_display_area()
+{
+    //Dot clock dividers and widths for the 256, 320, 512 and 640 pixel modes
+    static const int dividers[] = {10, 8, 5, 4};
+    static const int widths[] = {256, 320, 512, 640};
+    int divider = display_mode.h_res_368 ? 7 : dividers[display_mode.h_res];
+    int max_w = display_mode.h_res_368 ? 368 : widths[display_mode.h_res];
+    int max_h = display_mode.PAL ? 288 : 240;
+
+    //The ranges crop the picture; widths are rounded to 4 pixels like on hardware
+    int w = (((display_range.x2 - display_range.x1) / divider) + 2) & ~0x3;
+    if (w <= 0 || w > max_w)
+        w = max_w;
+    int h = display_range.y2 - display_range.y1;
+    if (h <= 0 || h > max_h)
+        h = max_h;
+    if (display_mode.interlaced && display_mode.v_res_480)
+        h *= 2;
+
+    if (w != display_w || h != display_h)
+        full_redraw = true;
+    display_w = w;
+    display_h = h;
+}
+
+void GPU::get_resolution(int &w, int &h)
+{
+    w = display_w;
+    h = display_h;
+}
+
+double GPU::get_field_rate()
+{
+    return display_mode.PAL ? PAL_FIELD_RATE : NTSC_FIELD_RATE;
 }
 
-uint32_t* GPU::get_framebuffer()
+void GPU::set_frame_output(FrameMailbox* mailbox, function<void()> frame_ready)
 {
-    return framebuffer;
+    scanout.set_frame_output(mailbox, frame_ready);
+}
+
+void GPU::set_output_size(int w, int h)
+{
+    scanout.set_output_size(w, h);
+}
+
+void GPU::set_scale_mode(SCALE_MODE mode)
+{
+    scanout.set_scale_mode(mode);
+}
+
+void GPU::set_skip_frame(bool skip)
+{
+    //Takes effect at the next VBLANK, so a frame is either drawn completely or not at all
+    skip_next = skip;
 }
 
 uint32_t GPU::read_response()
@@ -99,34 +277,34 @@ uint32_t GPU::read_response()
     uint32_t value = 0;
     if (read_transfer)
     {
-        //printf("Transfer: %d\n", transfer_x);
-        value = *(uint32_t*)&VRAM[(transfer_x + (transfer_y * 1024)) * 2];
+        sync();
+        read_VRAM_pixels((uint16_t*)&value, 2);
         printf("Read transfer: $%08X\n", value);
-        transfer_x += 2;
-        if (transfer_x >= transfer_x_bound)
-        {
-            transfer_y++;
-            if (transfer_y >= transfer_h)
-            {
-                read_transfer = false;
-                printf("[GPU] VRAM->CPU transfer ended!\n");
-            }
-            else
-                transfer_x -= transfer_w;
-        }
     }
     return value;
 }
 
+void GPU::read_response_block(uint32_t* words, int count)
+{
+    if (!read_transfer)
+    {
+        memset(words, 0, count * sizeof(uint32_t));
+        return;
+    }
+    sync();
+    read_VRAM_pixels((uint16_t*)words, count * 2);
+}
+
 uint32_t GPU::read_stat()
 {
-    uint32_t reg = 0;
-    reg |= draw_mode.texbase_x;
-    reg |= draw_mode.texbase_y << 4;
-    reg |= draw_mode.semi_trans << 5;
-    reg |= draw_mode.tex_colors << 7;
-    reg |= force_mask_draw << 11;
-    reg |= check_mask << 12;
+    uint32_t reg = stat_draw_mode;
+    reg |= display_mode.h_res_368 << 16;
+    reg |= display_mode.h_res << 17;
+    reg |= display_mode.v_res_480 << 19;
+    reg |= display_mode.PAL << 20;
+    reg |= display_mode.color_24bit << 21;
+    reg |= display_mode.interlaced << 22;
+    reg |= !display_enabled << 23;
     reg |= IRQ << 24;
     switch (transfer_dir)
     {
@@ -148,63 +326,43 @@ uint32_t GPU::read_stat()
     return reg;
 }
 
-void GPU::draw_quad(bool textured, bool shaded)
+int32_t GPU::orient2D(const Vertex &v1, const Vertex &v2, const Vertex &v3)
 {
-    Vertex tri1[3], tri2[3];
-
-    int cmd = textured | (shaded << 1);
-    switch (cmd)
-    {
-        case 0:
-            tri1[0] = Vertex(params[0], option);
-            tri1[1] = Vertex(params[1], option);
-            tri1[2] = Vertex(params[2], option);
-
-            tri2[0] = Vertex(params[1], option);
-            tri2[1] = Vertex(params[2], option);
-            tri2[2] = Vertex(params[3], option);
-            break;
-        case 1:
-            tri1[0] = Vertex(params[0], option);
-            tri1[0].set_texcoords(params[1]);
-            tri1[1] = Vertex(params[2], option);
-            tri1[1].set_texcoords(params[3]);
-            tri1[2] = Vertex(params[4], option);
-            tri1[2].set_texcoords(params[5]);
-
-            tri2[0] = Vertex(params[2], option);
-            tri2[0].set_texcoords(params[3]);
-            tri2[1] = Vertex(params[4], option);
-            tri2[1].set_texcoords(params[5]);
-            tri2[2] = Vertex(params[6], option);
-            tri2[2].set_texcoords(params[7]);
-            break;
-        case 2:
-            tri1[0] = Vertex(params[0], option);
-            tri1[1] = Vertex(params[2], params[1]);
-            tri1[2] = Vertex(params[4], params[3]);
-
-            tri2[0] = Vertex(params[2], params[1]);
-            tri2[1] = Vertex(params[4], params[3]);
-            tri2[2] = Vertex(params[6], params[5]);
-            break;
-    }
-
-    draw_tri(tri1);
-    draw_tri(tri2);
+    return (v2.x - v1.x) * (v3.y - v1.y) - (v3.x - v1.x) * (v2.y - v1.y);
 }
 
-int32_t GPU::orient2D(Vertex &v1, Vertex &v2, Vertex &v3)
+bool GPU::clip_bounds(Primitive& prim, int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y)
 {
-    return (v2.x - v1.x) * (v3.y - v1.y) - (v3.x - v1.x) * (v2.y - v1.y);
+    min_x = max(min_x, (int32_t)clip_area.x1);
+    min_y = max(min_y, (int32_t)clip_area.y1);
+    max_x = min(max_x, (int32_t)clip_area.x2);
+    max_y = min(max_y, (int32_t)clip_area.y2);
+    if (min_x > max_x || min_y > max_y)
+        return false;
+
+    prim.bounds.x1 = min_x;
+    prim.bounds.y1 = min_y;
+    prim.bounds.x2 = max_x;
+    prim.bounds.y2 = max_y;
+    return true;
 }
 
 void GPU::draw_tri(Vertex vertices[])
 {
-    uint32_t texpage_x = context.texpage & 0xF;
-    uint32_t texpage_y = ((context.texpage >> 4) & 0x1) * 256;
-    int color_depth = (context.texpage >> 7) & 0x3;
-    Vertex v1 = vertices[0], v2 = vertices[1], v3 = vertices[2];
+    Primitive prim;
+    prim.type = PRIM_TRIANGLE;
+    prim.textured = context.textured;
+    prim.texpage_x = context.texpage & 0xF;
+    prim.texpage_y = ((context.texpage >> 4) & 0x1) * 256;
+    prim.color_depth = (context.texpage >> 7) & 0x3;
+    prim.palette = context.palette;
+
+    Vertex& v1 = prim.v[0];
+    Vertex& v2 = prim.v[1];
+    Vertex& v3 = prim.v[2];
+    v1 = vertices[0];
+    v2 = vertices[1];
+    v3 = vertices[2];
 
     v1.x += draw_offset.x;
     v2.x += draw_offset.x;
@@ -219,10 +377,107 @@ void GPU::draw_tri(Vertex vertices[])
     if (orient2D(v1, v2, v3) < 0)
         swap(v2, v3);
 
-    int32_t min_x = min({v1.x, v2.x, v3.x});
-    int32_t min_y = min({v1.y, v2.y, v3.y});
-    int32_t max_x = max({v1.x, v2.x, v3.x});
-    int32_t max_y = max({v1.y, v2.y, v3.y});
+    if (!clip_bounds(prim, min({v1.x, v2.x, v3.x}), min({v1.y, v2.y, v3.y}),
+                     max({v1.x, v2.x, v3.x}), max({v1.y, v2.y, v3.y})))
+        return;
+
+    draw_primitive(prim);
+}
+
+void GPU::draw_rect(Vertex& corner, int width, int height)
+{
+    printf("Draw rect: (%d, %d)\n", corner.x, corner.y);
+    Primitive prim;
+    prim.type = PRIM_RECTANGLE;
+    prim.textured = context.textured;
+    prim.texpage_x = draw_mode.texbase_x;
+    prim.texpage_y = draw_mode.texbase_y * 256;
+    prim.color_depth = draw_mode.tex_colors;
+    prim.palette = context.palette;
+    prim.v[0] = corner;
+
+    if (!clip_bounds(prim, corner.x, corner.y, corner.x + width - 1, corner.y + height - 1))
+        return;
+
+    draw_primitive(prim);
+}
+
+void GPU::draw_line(Vertex vertices[])
+{
+    Primitive prim;
+    prim.type = PRIM_LINE;
+    prim.textured = false;
+    prim.texpage_x = 0;
+    prim.texpage_y = 0;
+    prim.color_depth = 0;
+    prim.palette = 0;
+
+    Vertex& v1 = prim.v[0];
+    Vertex& v2 = prim.v[1];
+    v1 = vertices[0];
+    v2 = vertices[1];
+
+    v1.x += draw_offset.x;
+    v2.x += draw_offset.x;
+
+    v1.y += draw_offset.y;
+    v2.y += draw_offset.y;
+
+    printf("[GPU] Draw line: (%d, %d) (%d, %d)\n", v1.x, v1.y, v2.x, v2.y);
+
+    //The GPU skips lines that are too long to rasterize
+    if (abs(v2.x - v1.x) >= 1024 || abs(v2.y - v1.y) >= 512)
+        return;
+
+    if (!clip_bounds(prim, min(v1.x, v2.x), min(v1.y, v2.y), max(v1.x, v2.x), max(v1.y, v2.y)))
+        return;
+
+    draw_primitive(prim);
+}
+
+void GPU::draw_primitive(Primitive& prim)
+{
+    if (tiled)
+    {
+        bin_primitive(prim);
+        return;
+    }
+
+    prim.texels = nullptr;
+    if (prim.textured)
+        prim.texels = get_texture(prim.texpage_x, prim.texpage_y, prim.palette, prim.color_depth);
+
+    rasterize(prim, prim.bounds);
+    mark_dirty(prim.bounds.x1, prim.bounds.y1,
+               prim.bounds.x2 - prim.bounds.x1 + 1, prim.bounds.y2 - prim.bounds.y1 + 1);
+}
+
+void GPU::rasterize(const Primitive& prim, const ClipArea& area)
+{
+    switch (prim.type)
+    {
+        case PRIM_TRIANGLE:
+            rasterize_tri(prim, area);
+            break;
+        case PRIM_RECTANGLE:
+            rasterize_rect(prim, area);
+            break;
+        case PRIM_LINE:
+            rasterize_line(prim, area);
+            break;
+    }
+}
+
+void GPU::rasterize_tri(const Primitive& prim, const ClipArea& area)
+{
+    const Vertex& v1 = prim.v[0];
+    const Vertex& v2 = prim.v[1];
+    const Vertex& v3 = prim.v[2];
+
+    int32_t min_x = area.x1;
+    int32_t min_y = area.y1;
+    int32_t max_x = area.x2;
+    int32_t max_y = area.y2;
 
     int32_t A12 = v1.y - v2.y;
     int32_t B12 = v2.x - v1.x;
@@ -267,12 +522,12 @@ void GPU::draw_tri(Vertex vertices[])
                 int r = ((float) r1 * w1 + (float) r2 * w2 + (float) r3 * w3) / divider;
                 int g = ((float) g1 * w1 + (float) g2 * w2 + (float) g3 * w3) / divider;
                 int b = ((float) b1 * w1 + (float) b2 * w2 + (float) b3 * w3) / divider;
-                if (context.textured)
+                if (prim.textured)
                 {
                     int s = ((float) v1.s * w1 + (float) v2.s * w2 + (float) v3.s * w3) / divider;
                     int t = ((float) v1.t * w1 + (float) v2.t * w2 + (float) v3.t * w3) / divider;
 
-                    uint16_t tex_color = tex_lookup(texpage_x, texpage_y, s, t, color_depth);
+                    uint16_t tex_color = tex_lookup(prim.texels, prim.texpage_x, prim.texpage_y, s, t);
 
                     r = (tex_color & 0x1F) << 3;
                     g = ((tex_color >> 5) & 0x1F) << 3;
@@ -298,22 +553,22 @@ void GPU::draw_tri(Vertex vertices[])
     }
 }
 
-void GPU::draw_rect(Vertex& corner, int width, int height)
+void GPU::rasterize_rect(const Primitive& prim, const ClipArea& area)
 {
-    printf("Draw rect: (%d, %d)\n", corner.x, corner.y);
+    const Vertex& corner = prim.v[0];
     bool transparent = false;
-    for (int y = corner.y; y < corner.y + height; y++)
+    for (int y = area.y1; y <= area.y2; y++)
     {
-        for (int x = corner.x; x < corner.x + width; x++)
+        for (int x = area.x1; x <= area.x2; x++)
         {
-            int r = option & 0xFF;
-            int g = (option >> 8) & 0xFF;
-            int b = (option >> 16) & 0xFF;
-            if (context.textured)
+            int r = corner.color & 0xFF;
+            int g = (corner.color >> 8) & 0xFF;
+            int b = (corner.color >> 16) & 0xFF;
+            if (prim.textured)
             {
                 int s = (x - corner.x) & 0xFF;
                 int t = (y - corner.y) & 0xFF;
-                uint16_t tex_color = tex_lookup(draw_mode.texbase_x, draw_mode.texbase_y * 256, s, t, draw_mode.tex_colors);
+                uint16_t tex_color = tex_lookup(prim.texels, prim.texpage_x, prim.texpage_y, s, t);
 
                 r = (tex_color & 0x1F) << 3;
                 g = ((tex_color >> 5) & 0x1F) << 3;
@@ -330,11 +585,49 @@ void GPU::draw_rect(Vertex& corner, int width, int height)
     }
 }
 
-void GPU::draw_pixel(uint16_t x, uint16_t y, uint32_t color)
+void GPU::rasterize_line(const Primitive& prim, const ClipArea& area)
 {
-    if (x < clip_area.x1 || x > clip_area.x2 || y < clip_area.y1 || y > clip_area.y2)
-        return;
+    const Vertex& v1 = prim.v[0];
+    const Vertex& v2 = prim.v[1];
+    int32_t dx = v2.x - v1.x;
+    int32_t dy = v2.y - v1.y;
+    int32_t steps = max(abs(dx), abs(dy));
+
+    int r1 = v1.color & 0xFF;
+    int g1 = (v1.color >> 8) & 0xFF;
+    int b1 = (v1.color >> 16) & 0xFF;
+    int dr = (int)(v2.color & 0xFF) - r1;
+    int dg = (int)((v2.color >> 8) & 0xFF) - g1;
+    int db = (int)((v2.color >> 16) & 0xFF) - b1;
 
+    //16.16 fixed point DDA, starting from the center of the first pixel
+    int32_t x = (v1.x << 16) + (1 << 15);
+    int32_t y = (v1.y << 16) + (1 << 15);
+    int32_t step_x = steps ? (dx << 16) / steps : 0;
+    int32_t step_y = steps ? (dy << 16) / steps : 0;
+
+    for (int32_t i = 0; i <= steps; i++)
+    {
+        int32_t pix_x = x >> 16;
+        int32_t pix_y = y >> 16;
+        if (pix_x >= area.x1 && pix_x <= area.x2 && pix_y >= area.y1 && pix_y <= area.y2)
+        {
+            int r = r1, g = g1, b = b1;
+            if (steps)
+            {
+                r += (dr * i) / steps;
+                g += (dg * i) / steps;
+                b += (db * i) / steps;
+            }
+            draw_pixel(pix_x, pix_y, r | (g << 8) | (b << 16));
+        }
+        x += step_x;
+        y += step_y;
+    }
+}
+
+void GPU::draw_pixel(uint16_t x, uint16_t y, uint32_t color)
+{
     uint16_t final_color;
     int r = (color & 0xFF) >> 3;
     int g = ((color >> 8) & 0xFF) >> 3;
@@ -345,312 +638,856 @@ void GPU::draw_pixel(uint16_t x, uint16_t y, uint32_t color)
     *(uint16_t*)&VRAM[(x + (y * 1024)) * 2] = final_color;
 }
 
-uint16_t GPU::tex_lookup(uint32_t texpage_x, uint32_t texpage_y, uint8_t s, uint8_t t, uint8_t color_depth)
+void GPU::texture_blocks(const Primitive& prim, uint16_t* blocks)
 {
-    uint32_t base = ((texpage_x * 64) + (texpage_y * 1024)) * 2;
-    base += (t * 2048);
-    //printf("Base: $%08X Texpage: $%08X\n", base, context.texpage);
-
-    int pal_index;
-    uint16_t color;
-    uint32_t palette_addr;
-    switch (color_depth)
+    uint32_t page_x = prim.texpage_x * 64;
+    switch (prim.color_depth)
     {
         case 0:
-            //printf("(%d, %d)\n", s, t);
-            palette_addr = context.palette * 16 * 2;
-            pal_index = *(uint8_t*)&VRAM[base + (s / 2)];
-            if (s & 0x1)
-                pal_index >>= 4;
-            else
-                pal_index &= 0xF;
-            color = *(uint16_t*)&VRAM[palette_addr + (pal_index * 2)];
+            TextureCache::mark_blocks(blocks, page_x, prim.texpage_y, 64, 256);
+            TextureCache::mark_blocks(blocks, (prim.palette & 0x3F) * 16, (prim.palette >> 6) & 0x1FF, 16, 1);
             break;
         case 1:
-            palette_addr = context.palette * 256 * 2;
-            pal_index = *(uint8_t*)&VRAM[base + s];
-            color = *(uint16_t*)&VRAM[palette_addr + (pal_index * 2)];
+            TextureCache::mark_blocks(blocks, page_x, prim.texpage_y, 128, 256);
+            TextureCache::mark_blocks(blocks, (prim.palette & 0x3F) * 16, (prim.palette >> 6) & 0x1FF, 256, 1);
+            break;
+        default:
+            TextureCache::mark_blocks(blocks, page_x, prim.texpage_y, 256, 256);
             break;
+    }
+}
+
+void GPU::bin_primitive(Primitive& prim)
+{
+    uint16_t draw_blocks[TEXCACHE_BLOCK_ROWS] = {};
+    uint16_t tex_blocks[TEXCACHE_BLOCK_ROWS] = {};
+    uint32_t x = prim.bounds.x1;
+    uint32_t y = prim.bounds.y1;
+    uint32_t w = prim.bounds.x2 - prim.bounds.x1 + 1;
+    uint32_t h = prim.bounds.y2 - prim.bounds.y1 + 1;
+    TextureCache::mark_blocks(draw_blocks, x, y, w, h);
+    if (prim.textured)
+        texture_blocks(prim, tex_blocks);
+
+    //Tiles run out of order relative to each other, so a primitive sampling VRAM that an earlier one in the batch
+    //draws to (or drawing over a texture an earlier one samples) has to wait for the batch to land first.
+    //Decoded pages must also stay resident while the batch refers to them.
+    bool self_hazard = false;
+    for (int i = 0; i < TEXCACHE_BLOCK_ROWS && !self_hazard; i++)
+        self_hazard = tex_blocks[i] & draw_blocks[i];
+    bool hazard = self_hazard || batch.size() >= MAX_BATCH_SIZE || batch_page_count >= TEXCACHE_ENTRIES - 1;
+    for (int i = 0; i < TEXCACHE_BLOCK_ROWS && !hazard; i++)
+        hazard = (tex_blocks[i] & batch_draw_blocks[i]) || (draw_blocks[i] & batch_tex_blocks[i]);
+    if (hazard)
+        flush_batch();
+
+    prim.texels = nullptr;
+    if (prim.textured)
+    {
+        prim.texels = get_texture(prim.texpage_x, prim.texpage_y, prim.palette, prim.color_depth);
+        if (prim.texels && find(batch_pages, batch_pages + batch_page_count, prim.texels) == batch_pages + batch_page_count)
+        {
+            batch_pages[batch_page_count] = prim.texels;
+            batch_page_count++;
+        }
+    }
+
+    //Nothing earlier in the batch samples this area, so cached pages can be dropped now rather than after
+    //rasterization. A primitive drawing over its own texture page or CLUT invalidates the page it holds, which
+    //the cache may then hand out again, so it goes out on its own before anything else is binned.
+    mark_dirty(x, y, w, h);
+    for (int i = 0; i < TEXCACHE_BLOCK_ROWS; i++)
+    {
+        batch_draw_blocks[i] |= draw_blocks[i];
+        batch_tex_blocks[i] |= tex_blocks[i];
+    }
+
+    uint16_t index = batch.size();
+    batch.push_back(prim);
+    for (int tile_y = prim.bounds.y1 / TILE_SIZE; tile_y <= prim.bounds.y2 / TILE_SIZE; tile_y++)
+    {
+        for (int tile_x = prim.bounds.x1 / TILE_SIZE; tile_x <= prim.bounds.x2 / TILE_SIZE; tile_x++)
+        {
+            int tile = tile_x + (tile_y * TILES_X);
+            if (tile_bins[tile].empty())
+                active_tiles.push_back(tile);
+            tile_bins[tile].push_back(index);
+        }
+    }
+    batch_pending.store(true);
+    if (self_hazard)
+        flush_batch();
+}
+
+void GPU::flush_batch()
+{
+    if (batch.empty())
+        return;
+
+    tile_pool.parallel_for(active_tiles.size(), [this](int job)
+    {
+        int tile = active_tiles[job];
+        ClipArea tile_area;
+        tile_area.x1 = (tile % TILES_X) * TILE_SIZE;
+        tile_area.y1 = (tile / TILES_X) * TILE_SIZE;
+        tile_area.x2 = tile_area.x1 + TILE_SIZE - 1;
+        tile_area.y2 = tile_area.y1 + TILE_SIZE - 1;
+
+        //Primitives are rasterized in submission order within a tile, so every pixel sees them in order
+        vector<uint16_t>& bin = tile_bins[tile];
+        for (unsigned int i = 0; i < bin.size(); i++)
+        {
+            const Primitive& prim = batch[bin[i]];
+            ClipArea area;
+            area.x1 = max(prim.bounds.x1, tile_area.x1);
+            area.y1 = max(prim.bounds.y1, tile_area.y1);
+            area.x2 = min(prim.bounds.x2, tile_area.x2);
+            area.y2 = min(prim.bounds.y2, tile_area.y2);
+            rasterize(prim, area);
+        }
+        bin.clear();
+    });
+
+    batch.clear();
+    active_tiles.clear();
+    memset(batch_draw_blocks, 0, sizeof(batch_draw_blocks));
+    memset(batch_tex_blocks, 0, sizeof(batch_tex_blocks));
+    batch_page_count = 0;
+    batch_pending.store(false);
+}
+
+void GPU::set_tiled(bool tiled)
+{
+    if (this->tiled == tiled)
+        return;
+
+    sync();
+    if (tiled)
+    {
+        int threads = thread::hardware_concurrency();
+        tile_pool.start(max(threads - 1, 1));
+    }
+    else
+        tile_pool.shutdown();
+    this->tiled = tiled;
+}
+
+const uint16_t* GPU::get_texture(uint32_t texpage_x, uint32_t texpage_y, uint16_t palette, uint8_t color_depth)
+{
+    switch (color_depth)
+    {
+        case 0:
+        case 1:
+            //Paletted textures are decoded once through their CLUT and reused until VRAM under them changes
+            return tex_cache.get_page(texpage_x, texpage_y, palette, color_depth);
         case 2:
         case 3:
-            color = *(uint16_t*)&VRAM[base + (s * 2)];
-            color = 0x8000;
-            break;
+            return nullptr;
         default:
             printf("[GPU] Unrecognized texture color %d\n", color_depth);
             exit(1);
     }
+}
+
+uint16_t GPU::tex_lookup(const uint16_t* texels, uint32_t texpage_x, uint32_t texpage_y, uint8_t s, uint8_t t)
+{
+    if (texels)
+        return texels[s + (t * 256)];
+
+    uint32_t base = ((texpage_x * 64) + (texpage_y * 1024)) * 2;
+    base += (t * 2048);
+    uint16_t color = *(uint16_t*)&VRAM[base + (s * 2)];
+    color = 0x8000;
     return color;
 }
 
+constexpr GP0Table build_GP0_table()
+{
+    GP0Table table = {};
+    for (int i = 0; i < 256; i++)
+    {
+        GP0Command& op = table.ops[i];
+        op.params = 0;
+        op.flags = 0;
+        op.handler = &GPU::gp0_nop;
+
+        if (i >= 0x20 && i < 0x40)
+        {
+            if (i & 0x01)
+                op.flags |= GP0_RAW_TEXTURE;
+            if (i & 0x02)
+                op.flags |= GP0_SEMI_TRANS;
+            if (i & 0x04)
+                op.flags |= GP0_TEXTURED;
+            if (i & 0x08)
+                op.flags |= GP0_QUAD;
+            if (i & 0x10)
+                op.flags |= GP0_SHADED;
+
+            //Every vertex has a position and maybe texcoords; all but the first also have a color when shaded
+            int vertices = (i & 0x08) ? 4 : 3;
+            op.params = vertices * ((i & 0x04) ? 2 : 1);
+            if (i & 0x10)
+                op.params += vertices - 1;
+            op.flags |= GP0_DRAW;
+            op.handler = &GPU::gp0_polygon;
+        }
+        else if (i >= 0x40 && i < 0x60)
+        {
+            if (i & 0x02)
+                op.flags |= GP0_SEMI_TRANS;
+            if (i & 0x08)
+                op.flags |= GP0_POLYLINE;
+            if (i & 0x10)
+                op.flags |= GP0_SHADED;
+
+            //Polylines are cut into single segments as their vertices arrive
+            op.params = (i & 0x10) ? 3 : 2;
+            op.flags |= GP0_DRAW;
+            op.handler = &GPU::gp0_line;
+        }
+        else if (i >= 0x60 && i < 0x80)
+        {
+            if (i & 0x01)
+                op.flags |= GP0_RAW_TEXTURE;
+            if (i & 0x02)
+                op.flags |= GP0_SEMI_TRANS;
+            if (i & 0x04)
+                op.flags |= GP0_TEXTURED;
+
+            op.params = 1;
+            if (i & 0x04)
+                op.params++;
+            if (!(i & 0x18))
+                op.params++;
+            op.flags |= GP0_DRAW;
+            op.handler = &GPU::gp0_rect;
+        }
+        else if (i >= 0x80 && i < 0xA0)
+        {
+            op.params = 3;
+            op.handler = &GPU::gp0_copy;
+        }
+        else if (i >= 0xA0 && i < 0xC0)
+        {
+            op.params = 2;
+            op.flags = GP0_VRAM_WRITE;
+            op.handler = &GPU::gp0_write_VRAM;
+        }
+        else if (i >= 0xC0 && i < 0xE0)
+        {
+            op.params = 2;
+            op.flags = GP0_IMMEDIATE;
+            op.handler = &GPU::gp0_read_VRAM;
+        }
+    }
+
+    table.ops[0x01].handler = &GPU::gp0_clear_cache;
+    table.ops[0x02].params = 2;
+    table.ops[0x02].handler = &GPU::gp0_fill;
+    table.ops[0x1F].flags = GP0_IMMEDIATE;
+    table.ops[0x1F].handler = &GPU::gp0_IRQ;
+
+    table.ops[0xE1].flags = GP0_STAT;
+    table.ops[0xE1].handler = &GPU::gp0_draw_mode;
+    table.ops[0xE2].handler = &GPU::gp0_tex_window;
+    table.ops[0xE3].handler = &GPU::gp0_clip_top_left;
+    table.ops[0xE4].handler = &GPU::gp0_clip_bottom_right;
+    table.ops[0xE5].handler = &GPU::gp0_draw_offset;
+    table.ops[0xE6].flags = GP0_STAT;
+    table.ops[0xE6].handler = &GPU::gp0_mask_bit;
+    return table;
+}
+
+static constexpr GP0Table GP0_TABLE = build_GP0_table();
+
 void GPU::write_GP0(uint32_t value)
 {
     printf("[GPU] Write GP0: $%08X\n", value);
     if (write_transfer)
     {
-        printf("Transfer: $%08X (%d, %d) ($%08X)\n", value, transfer_x, transfer_y, (transfer_x + (transfer_y * 1024)) * 2);
-        *(uint32_t*)&VRAM[(transfer_x + (transfer_y * 1024)) * 2] = value;
-        transfer_x += 2;
-        if (transfer_x >= transfer_x_bound)
+        submit_packet(&value, 1, GP0_DATA_PACKET);
+        transfer_words_left--;
+        if (!transfer_words_left)
+        {
+            write_transfer = false;
+            printf("[GPU] CPU->VRAM transfer ended!\n");
+        }
+        return;
+    }
+    if (stat.ready_cmd)
+    {
+        const GP0Command& op = GP0_TABLE.ops[value >> 24];
+        packet[0] = value;
+        packet_size = 1;
+        params_needed = op.params;
+        if (op.flags & GP0_STAT)
+            update_stat_draw_mode(value);
+
+        if (params_needed)
+            stat.ready_cmd = false;
+        else
+            end_packet();
+    }
+    else
+    {
+        //Polylines run until a terminator shows up where the next vertex (or color) would be
+        if (polyline && packet_size == 2 && (value & 0xF000F000) == 0x50005000)
+        {
+            polyline = false;
+            stat.ready_cmd = true;
+            return;
+        }
+
+        packet[packet_size] = value;
+        packet_size++;
+
+        if (packet_size > params_needed)
+            end_packet();
+    }
+}
+
+//Bulk version of write_GP0 for DMA. Commands that fit entirely inside the buffer skip the word-by-word state
+//machine and are submitted straight from it; anything else (split commands, polylines, transfers) falls back to it.
+void GPU::write_GP0_packet(const uint32_t* words, int count)
+{
+    int i = 0;
+    while (i < count)
+    {
+        if (write_transfer)
         {
-            transfer_y++;
-            if (transfer_y >= transfer_h)
+            uint32_t chunk = count - i;
+            if (chunk > transfer_words_left)
+                chunk = transfer_words_left;
+            if (chunk > GP0FIFO::MAX_PACKET)
+                chunk = GP0FIFO::MAX_PACKET;
+            submit_packet(&words[i], chunk, GP0_DATA_PACKET);
+            transfer_words_left -= chunk;
+            i += chunk;
+            if (!transfer_words_left)
             {
                 write_transfer = false;
                 printf("[GPU] CPU->VRAM transfer ended!\n");
             }
-            else
-                transfer_x -= transfer_w;
+            continue;
         }
+
+        if (stat.ready_cmd)
+        {
+            const GP0Command& op = GP0_TABLE.ops[words[i] >> 24];
+            if (!(op.flags & (GP0_POLYLINE | GP0_VRAM_WRITE | GP0_IMMEDIATE)) && i + op.params < count)
+            {
+                if (op.flags & GP0_STAT)
+                    update_stat_draw_mode(words[i]);
+                submit_packet(&words[i], op.params + 1, 0);
+                i += op.params + 1;
+                continue;
+            }
+        }
+
+        write_GP0(words[i]);
+        i++;
+    }
+}
+
+void GPU::update_stat_draw_mode(uint32_t value)
+{
+    switch (value >> 24)
+    {
+        case 0xE1:
+            stat_draw_mode = (stat_draw_mode & ~0x1FF) | (value & 0x1FF);
+            break;
+        case 0xE6:
+            stat_draw_mode = (stat_draw_mode & ~0x1800) | ((value & 0x3) << 11);
+            break;
+    }
+}
+
+void GPU::end_packet()
+{
+    const GP0Command& op = GP0_TABLE.ops[packet[0] >> 24];
+    if (op.flags & GP0_POLYLINE)
+    {
+        submit_packet(packet, packet_size, 0);
+
+        //The last vertex, along with its color when shaded, starts the next segment
+        if (op.flags & GP0_SHADED)
+        {
+            packet[0] = (packet[0] & 0xFF000000) | (packet[2] & 0xFFFFFF);
+            packet[1] = packet[3];
+        }
+        else
+            packet[1] = packet[2];
+        packet_size = 2;
+        polyline = true;
         return;
     }
-    if (stat.ready_cmd)
+
+    stat.ready_cmd = true;
+    if (op.flags & GP0_VRAM_WRITE)
+    {
+        //The data words that follow go straight through the FIFO, so only their count matters here
+        uint32_t w, h;
+        transfer_dimensions(packet[2], w, h);
+        transfer_words_left = ((w * h) + 1) / 2;
+        write_transfer = transfer_words_left != 0;
+    }
+
+    if (op.flags & GP0_IMMEDIATE)
+        (this->*op.handler)(packet, op.flags);
+    else
+        submit_packet(packet, packet_size, 0);
+}
+
+void GPU::submit_packet(const uint32_t* words, int count, uint32_t flags)
+{
+    if (skip_draw && !flags && (GP0_TABLE.ops[words[0] >> 24].flags & GP0_DRAW))
+        return;
+
+    if (!threaded)
     {
-        cmd = value >> 24;
-        option = value & 0xFFFFFF;
-        switch (cmd)
+        if (flags & GP0_SYNC_PACKET)
+            flush_batch();
+        else if (flags & GP0_DATA_PACKET)
+            write_VRAM_pixels((const uint16_t*)words, count * 2);
+        else
+            exec_command(words);
+        return;
+    }
+
+    if (fifo.free_space() < (uint32_t)count + 1)
+    {
+        std::unique_lock<std::mutex> lock(render_mutex);
+        render_idle.wait(lock, [this] { return fifo.empty(); });
+    }
+
+    uint32_t header = count | flags;
+    fifo.push(header, words, count);
+
+    if (render_sleeping.load())
+    {
+        std::lock_guard<std::mutex> lock(render_mutex);
+        render_wake.notify_one();
+    }
+}
+
+void GPU::render_loop()
+{
+    uint32_t words[GP0FIFO::MAX_PACKET];
+    while (true)
+    {
+        if (fifo.empty())
+        {
+            std::unique_lock<std::mutex> lock(render_mutex);
+            render_sleeping.store(true);
+            render_wake.wait(lock, [this] { return !fifo.empty() || render_stop; });
+            render_sleeping.store(false);
+            if (fifo.empty())
+                return;
+        }
+
+        uint32_t header = fifo.front(words);
+        int count = header & GP0_PACKET_SIZE;
+        if (header & GP0_SYNC_PACKET)
+            flush_batch();
+        else if (header & GP0_DATA_PACKET)
+            write_VRAM_pixels((const uint16_t*)words, count * 2);
+        else
+            exec_command(words);
+        fifo.pop();
+
+        if (fifo.empty())
         {
-            case 0x00:
-                //NOP
-                break;
-            case 0x01:
-                printf("[GPU] Clear cache\n");
-                break;
-            case 0x02:
-                printf("[GPU] Fill VRAM\n");
-                stat.ready_cmd = false;
-                params_needed = 2;
-                break;
-            case 0x27:
-                printf("[GPU] Textured three-point polygon: $%08X\n", option);
-                stat.ready_cmd = false;
-                params_needed = 6;
-                break;
-            case 0x28:
-                printf("[GPU] Monochrome four-point polygon: $%08X\n", option);
-                stat.ready_cmd = false;
-                params_needed = 4;
-                break;
-            case 0x2C:
-                printf("[GPU] Textured four-point polygon, opaque, blended: $%08X\n", option);
-                stat.ready_cmd = false;
-                params_needed = 8;
-                break;
-            case 0x2D:
-                printf("[GPU] Textured four-point polygon, opaque, raw: $%08X\n", option);
-                stat.ready_cmd = false;
-                params_needed = 8;
-                break;
-            case 0x30:
-                printf("[GPU] Shaded three-point polygon: $%08X\n", option);
-                stat.ready_cmd = false;
-                params_needed = 5;
-                break;
-            case 0x38:
-                printf("[GPU] Shaded four-point polygon: $%08X\n", option);
-                stat.ready_cmd = false;
-                params_needed = 7;
-                break;
-            case 0x65:
-                printf("[GPU] Textured rectangle, variable size, opaque, raw: $%08X\n", option);
-                stat.ready_cmd = false;
-                params_needed = 3;
-                break;
-            case 0x78:
-                printf("[GPU] Monochrome rectangle, opaque: $%08X\n", option);
-                stat.ready_cmd = false;
-                params_needed = 1;
-                break;
-            case 0xA0:
-                printf("[GPU] CPU->VRAM transfer\n");
-                stat.ready_cmd = false;
-                params_needed = 2;
-                break;
-            case 0xC0:
-                printf("[GPU] VRAM->CPU transfer\n");
-                stat.ready_cmd = false;
-                params_needed = 2;
-                break;
-            case 0xE1:
-                printf("[GPU] Draw mode: $%08X\n", option);
-                draw_mode.texbase_x = value & 0xF;
-                draw_mode.texbase_y = value & (1 << 4);
-                draw_mode.semi_trans = (value >> 5) & 0x3;
-                draw_mode.tex_colors = (value >> 7) & 0x3;
-                draw_mode.tex_rect_x_flip = value & (1 << 12);
-                draw_mode.tex_rect_y_flip = value & (1 << 13);
-                break;
-            case 0xE2:
-                printf("[GPU] Tex window: $%08X\n", option);
-                tex_window.mask_x = value & 0x1F;
-                tex_window.mask_y = (value >> 5) & 0x1F;
-                tex_window.offset_x = (value >> 10) & 0x1F;
-                tex_window.offset_y = (value >> 15) & 0x1F;
-                break;
-            case 0xE3:
-                printf("[GPU] Top-left clip: $%08X\n", option);
-                clip_area.x1 = value & 0x3FF;
-                clip_area.y1 = (value >> 10) & 0x1FF;
-                break;
-            case 0xE4:
-                printf("[GPU] Bottom-right clip: $%08X\n", option);
-                clip_area.x2 = value & 0x3FF;
-                clip_area.y2 = (value >> 10) & 0x1FF;
-                printf("(%d, %d) (%d, %d)\n", clip_area.x1, clip_area.y1, clip_area.x2, clip_area.y2);
-                break;
-            case 0xE5:
-                printf("[GPU] Draw offset: $%08X\n", option);
-                draw_offset.x = ((int16_t)((value & 0x7FF) << 4)) >> 4;
-                draw_offset.y = ((int16_t)(((value >> 11) & 0x7FF) << 4)) >> 4;
-                break;
-            case 0xE6:
-                printf("[GPU] Mask Bit: $%08X\n", option);
-                force_mask_draw = value & 0x1;
-                check_mask = value & (1 << 1);
-                break;
-            default:
-                printf("[GPU] Unrecognized GP0 command $%02X! ($%08X)\n", cmd, value);
-                exit(1);
+            std::lock_guard<std::mutex> lock(render_mutex);
+            render_idle.notify_all();
         }
     }
+}
+
+void GPU::sync()
+{
+    if (!threaded)
+    {
+        flush_batch();
+        return;
+    }
+    if (fifo.empty() && !batch_pending.load())
+        return;
+
+    //Have the render thread rasterize anything still binned, then wait for it to drain
+    submit_packet(nullptr, 0, GP0_SYNC_PACKET);
+    std::unique_lock<std::mutex> lock(render_mutex);
+    render_idle.wait(lock, [this] { return fifo.empty(); });
+}
+
+void GPU::set_threaded(bool threaded)
+{
+    if (this->threaded == threaded)
+        return;
+
+    if (threaded)
+    {
+        fifo.clear();
+        render_stop = false;
+        render_sleeping.store(false);
+        this->threaded = true;
+        render_thread = std::thread(&GPU::render_loop, this);
+    }
     else
     {
-        params[cmd_params] = value;
-        cmd_params++;
+        sync();
+        {
+            std::lock_guard<std::mutex> lock(render_mutex);
+            render_stop = true;
+            render_wake.notify_one();
+        }
+        render_thread.join();
+        this->threaded = false;
+    }
+}
+
+//Called for every write to VRAM, so that cached texture pages and the converted frame get refreshed
+void GPU::mark_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    tex_cache.invalidate(x, y, w, h);
+    TextureCache::mark_blocks(display_dirty, x, y, w, h);
+}
+
+void GPU::start_transfer(const uint32_t* words, VRAMTransfer& cursor)
+{
+    cursor.x = words[1] & 0x3FF;
+    cursor.y = (words[1] >> 16) & 0x1FF;
+    transfer_dimensions(words[2], cursor.w, cursor.h);
+    cursor.col = 0;
+    cursor.row = 0;
+    printf("(%d, %d) (%d, %d)\n", cursor.x, cursor.y, cursor.w, cursor.h);
+}
 
-        if (cmd_params >= params_needed)
+//Copies pixels into the transfer rectangle a row run at a time, wrapping around the edges of VRAM.
+//A run only needs to be split where it crosses the right edge.
+void GPU::write_VRAM_pixels(const uint16_t* pixels, uint32_t count)
+{
+    uint16_t* VRAM16 = (uint16_t*)VRAM;
+    uint16_t set_mask = force_mask_draw ? 0x8000 : 0;
+    while (count && write_cursor.row < write_cursor.h)
+    {
+        uint16_t* row = &VRAM16[((write_cursor.y + write_cursor.row) & 0x1FF) * 1024];
+        uint32_t x = (write_cursor.x + write_cursor.col) & 0x3FF;
+        uint32_t run = min(count, write_cursor.w - write_cursor.col);
+        count -= run;
+        write_cursor.col += run;
+
+        while (run)
         {
-            stat.ready_cmd = true;
-            cmd_params = 0;
-            switch (cmd)
-            {
-                case 0x02:
-                {
-                    int fill_x = (params[0] & 0xFFFF);
-                    int fill_y = params[0] >> 16;
-
-                    int fill_w = (params[1] & 0xFFFF);
-                    int fill_x_bound = fill_w + fill_x;
-                    int fill_h = (params[1] >> 16) + fill_y;
-
-                    printf("(%d, %d) (%d, %d)\n", fill_x, fill_y, fill_w, fill_h);
-
-                    //The color in option is 24-bit but converted to 15-bit during fill
-                    uint16_t color = (option & 0xFF) >> 3;
-                    color |= ((option >> 8) & 0xFF) >> 3;
-                    color |= ((option >> 16) & 0xFF) >> 3;
-
-                    while (fill_y < fill_h)
-                    {
-                        printf("Fill: (%d, %d)\n", fill_x, fill_y);
-                        *(uint16_t*)&VRAM[(fill_x + (fill_y * 1024)) * 2] = color;
-                        fill_x++;
-                        if (fill_x >= fill_x_bound)
-                        {
-                            fill_x -= fill_w;
-                            fill_y++;
-                        }
-                    }
-                }
-                    break;
-                case 0x28:
-                    context.textured = false;
-                    context.texture_blending = false;
-                    context.opaque = true;
-                    draw_quad(false, false);
-                    break;
-                case 0x2C:
-                    context.textured = true;
-                    context.texture_blending = true;
-                    context.opaque = true;
-                    context.palette = params[1] >> 16;
-                    context.texpage = params[3] >> 16;
-                    printf("Palette: $%04X Texpage: $%04X\n", context.palette, context.texpage);
-                    draw_quad(true, false);
-                    break;
-                case 0x2D:
-                    context.textured = true;
-                    context.texture_blending = false;
-                    context.opaque = true;
-                    context.palette = params[1] >> 16;
-                    context.texpage = params[3] >> 16;
-                    printf("Palette: $%04X Texpage: $%04X\n", context.palette, context.texpage);
-                    draw_quad(true, false);
-                    break;
-                case 0x30:
-                {
-                    context.textured = false;
-                    context.texture_blending = false;
-                    context.opaque = true;
-                    Vertex tri[3];
-                    tri[0] = Vertex(params[0], option);
-                    tri[1] = Vertex(params[2], params[1]);
-                    tri[2] = Vertex(params[4], params[3]);
-                    draw_tri(tri);
-                }
-                    break;
-                case 0x38:
-                    context.textured = false;
-                    context.texture_blending = false;
-                    context.opaque = true;
-                    draw_quad(false, true);
-                    break;
-                case 0x65:
-                {
-                    context.textured = true;
-                    context.texture_blending = false;
-                    context.opaque = true;
-                    context.palette = params[1] >> 16;
-                    Vertex corner;
-                    corner = Vertex(params[0], option);
-                    corner.set_texcoords(params[1]);
-
-                    int w = params[2] & 0xFFFF;
-                    int h = params[2] >> 16;
-
-                    draw_rect(corner, w, h);
-                }
-                    break;
-                case 0x78:
-                {
-                    context.textured = false;
-                    context.opaque = true;
-                    Vertex corner;
-                    corner = Vertex(params[0], option);
-                    draw_rect(corner, 16, 16);
-                }
-                    break;
-                case 0xA0:
-                    transfer_x = params[0] & 0xFFFF;
-                    transfer_y = params[0] >> 16;
-                    transfer_w = params[1] & 0xFFFF;
-                    transfer_x_bound = transfer_x + transfer_w;
-                    transfer_h = (params[1] >> 16) + transfer_y;
-                    printf("(%d, %d) (%d, %d)\n", transfer_x, transfer_y, transfer_w, transfer_h);
-                    write_transfer = true;
-                    break;
-                case 0xC0:
-                    transfer_x = params[0] & 0xFFFF;
-                    transfer_y = params[0] >> 16;
-                    transfer_w = params[1] & 0xFFFF;
-                    transfer_x_bound = transfer_x + transfer_w;
-                    transfer_h = (params[1] >> 16) + transfer_y;
-                    printf("(%d, %d) (%d, %d)\n", transfer_x, transfer_y, transfer_w, transfer_h);
-                    read_transfer = true;
-                    break;
-                default:
-                    exit(1);
-            }
+            uint32_t len = min(run, 1024 - x);
+            copy_row(&row[x], pixels, len, set_mask, check_mask);
+            pixels += len;
+            run -= len;
+            x = 0;
+        }
+
+        if (write_cursor.col == write_cursor.w)
+        {
+            write_cursor.col = 0;
+            write_cursor.row++;
+        }
+    }
+}
+
+void GPU::read_VRAM_pixels(uint16_t* pixels, uint32_t count)
+{
+    uint16_t* VRAM16 = (uint16_t*)VRAM;
+    while (count && read_cursor.row < read_cursor.h)
+    {
+        uint16_t* row = &VRAM16[((read_cursor.y + read_cursor.row) & 0x1FF) * 1024];
+        uint32_t x = (read_cursor.x + read_cursor.col) & 0x3FF;
+        uint32_t run = min(count, read_cursor.w - read_cursor.col);
+        count -= run;
+        read_cursor.col += run;
+
+        while (run)
+        {
+            uint32_t len = min(run, 1024 - x);
+            memcpy(pixels, &row[x], len * sizeof(uint16_t));
+            pixels += len;
+            run -= len;
+            x = 0;
+        }
+
+        if (read_cursor.col == read_cursor.w)
+        {
+            read_cursor.col = 0;
+            read_cursor.row++;
         }
     }
+
+    //Reading past the end of the rectangle returns zeroes
+    memset(pixels, 0, count * sizeof(uint16_t));
+    if (read_transfer && read_cursor.row == read_cursor.h)
+    {
+        read_transfer = false;
+        printf("[GPU] VRAM->CPU transfer ended!\n");
+    }
+}
+
+void GPU::exec_command(const uint32_t* words)
+{
+    const GP0Command& op = GP0_TABLE.ops[words[0] >> 24];
+    (this->*op.handler)(words, op.flags);
+}
+
+void GPU::gp0_nop(const uint32_t*, uint16_t)
+{
+
+}
+
+void GPU::gp0_clear_cache(const uint32_t*, uint16_t)
+{
+    printf("[GPU] Clear cache\n");
+}
+
+void GPU::gp0_fill(const uint32_t* words, uint16_t)
+{
+    printf("[GPU] Fill VRAM\n");
+    flush_batch();
+    uint32_t option = words[0] & 0xFFFFFF;
+
+    //Fills work on 16 pixel columns; the position is rounded down and the width rounded up
+    uint32_t fill_x = words[1] & 0x3F0;
+    uint32_t fill_y = (words[1] >> 16) & 0x1FF;
+    uint32_t fill_w = ((words[2] & 0x3FF) + 0xF) & ~0xF;
+    uint32_t fill_h = (words[2] >> 16) & 0x1FF;
+
+    printf("(%d, %d) (%d, %d)\n", fill_x, fill_y, fill_w, fill_h);
+    mark_dirty(fill_x, fill_y, fill_w, fill_h);
+
+    //The color in option is 24-bit but converted to 15-bit during fill
+    uint16_t color = (option & 0xFF) >> 3;
+    color |= (((option >> 8) & 0xFF) >> 3) << 5;
+    color |= (((option >> 16) & 0xFF) >> 3) << 10;
+
+    //Fills ignore the mask bit settings and the drawing area, and wrap around VRAM
+    uint16_t* VRAM16 = (uint16_t*)VRAM;
+    uint32_t first = min(fill_w, 1024 - fill_x);
+    for (uint32_t y = 0; y < fill_h; y++)
+    {
+        uint16_t* row = &VRAM16[((fill_y + y) & 0x1FF) * 1024];
+        fill_row(&row[fill_x], color, first);
+        fill_row(row, color, fill_w - first);
+    }
+}
+
+void GPU::gp0_IRQ(const uint32_t*, uint16_t)
+{
+    printf("[GPU] IRQ request\n");
+    IRQ = true;
+}
+
+void GPU::gp0_polygon(const uint32_t* words, uint16_t flags)
+{
+    context.textured = flags & GP0_TEXTURED;
+    context.texture_blending = context.textured && !(flags & GP0_RAW_TEXTURE);
+    context.opaque = !(flags & GP0_SEMI_TRANS);
+
+    Vertex v[4];
+    int vertex_count = (flags & GP0_QUAD) ? 4 : 3;
+    uint32_t color = words[0] & 0xFFFFFF;
+    int index = 1;
+    for (int i = 0; i < vertex_count; i++)
+    {
+        if ((flags & GP0_SHADED) && i)
+        {
+            color = words[index];
+            index++;
+        }
+        v[i] = Vertex(words[index], color);
+        index++;
+        if (context.textured)
+        {
+            v[i].set_texcoords(words[index]);
+            if (i == 0)
+                context.palette = words[index] >> 16;
+            else if (i == 1)
+                context.texpage = words[index] >> 16;
+            index++;
+        }
+    }
+    if (context.textured)
+        printf("Palette: $%04X Texpage: $%04X\n", context.palette, context.texpage);
+
+    draw_tri(v);
+    if (vertex_count == 4)
+        draw_tri(v + 1);
+}
+
+void GPU::gp0_line(const uint32_t* words, uint16_t flags)
+{
+    Vertex v[2];
+    v[0] = Vertex(words[1], words[0] & 0xFFFFFF);
+    if (flags & GP0_SHADED)
+        v[1] = Vertex(words[3], words[2] & 0xFFFFFF);
+    else
+        v[1] = Vertex(words[2], words[0] & 0xFFFFFF);
+
+    context.textured = false;
+    context.texture_blending = false;
+    context.opaque = !(flags & GP0_SEMI_TRANS);
+    draw_line(v);
+}
+
+void GPU::gp0_rect(const uint32_t* words, uint16_t flags)
+{
+    context.textured = flags & GP0_TEXTURED;
+    context.texture_blending = context.textured && !(flags & GP0_RAW_TEXTURE);
+    context.opaque = !(flags & GP0_SEMI_TRANS);
+
+    Vertex corner = Vertex(words[1], words[0] & 0xFFFFFF);
+    int index = 2;
+    if (context.textured)
+    {
+        corner.set_texcoords(words[index]);
+        context.palette = words[index] >> 16;
+        index++;
+    }
+
+    int w, h;
+    switch ((words[0] >> 27) & 0x3)
+    {
+        case 0:
+            w = words[index] & 0xFFFF;
+            h = words[index] >> 16;
+            break;
+        case 1:
+            w = h = 1;
+            break;
+        case 2:
+            w = h = 8;
+            break;
+        default:
+            w = h = 16;
+            break;
+    }
+
+    draw_rect(corner, w, h);
+}
+
+void GPU::gp0_copy(const uint32_t* words, uint16_t)
+{
+    printf("[GPU] VRAM->VRAM transfer\n");
+    flush_batch();
+    uint32_t src_x = words[1] & 0x3FF;
+    uint32_t src_y = (words[1] >> 16) & 0x1FF;
+    uint32_t dest_x = words[2] & 0x3FF;
+    uint32_t dest_y = (words[2] >> 16) & 0x1FF;
+    uint32_t w, h;
+    transfer_dimensions(words[3], w, h);
+    printf("(%d, %d) -> (%d, %d) (%d, %d)\n", src_x, src_y, dest_x, dest_y, w, h);
+    mark_dirty(dest_x, dest_y, w, h);
+
+    //Go bottom-up when the destination overlaps lower rows of the source, so no row is overwritten before it's read
+    bool backwards = ((dest_y - src_y) & 0x1FF) != 0 && ((dest_y - src_y) & 0x1FF) < h;
+
+    uint16_t* VRAM16 = (uint16_t*)VRAM;
+    uint16_t set_mask = force_mask_draw ? 0x8000 : 0;
+    uint16_t line[1024];
+    for (uint32_t i = 0; i < h; i++)
+    {
+        uint32_t y = backwards ? (h - 1 - i) : i;
+        uint16_t* src_row = &VRAM16[((src_y + y) & 0x1FF) * 1024];
+        uint16_t* dest_row = &VRAM16[((dest_y + y) & 0x1FF) * 1024];
+
+        //Gather the source row first, which also takes care of copies within a row overlapping themselves
+        uint32_t first = min(w, 1024 - src_x);
+        memcpy(line, &src_row[src_x], first * sizeof(uint16_t));
+        memcpy(&line[first], src_row, (w - first) * sizeof(uint16_t));
+
+        first = min(w, 1024 - dest_x);
+        copy_row(&dest_row[dest_x], line, first, set_mask, check_mask);
+        copy_row(dest_row, &line[first], w - first, set_mask, check_mask);
+    }
+}
+
+void GPU::gp0_write_VRAM(const uint32_t* words, uint16_t)
+{
+    printf("[GPU] CPU->VRAM transfer\n");
+    flush_batch();
+    start_transfer(words, write_cursor);
+
+    //Nothing samples textures until the transfer is over, so the whole rectangle can be invalidated up front
+    mark_dirty(write_cursor.x, write_cursor.y, write_cursor.w, write_cursor.h);
+}
+
+void GPU::gp0_read_VRAM(const uint32_t* words, uint16_t)
+{
+    printf("[GPU] VRAM->CPU transfer\n");
+
+    //The CPU reads the result back right away, so all prior drawing must have landed in VRAM
+    sync();
+    start_transfer(words, read_cursor);
+    read_transfer = true;
+}
+
+void GPU::gp0_draw_mode(const uint32_t* words, uint16_t)
+{
+    uint32_t option = words[0] & 0xFFFFFF;
+    printf("[GPU] Draw mode: $%08X\n", option);
+    draw_mode.texbase_x = option & 0xF;
+    draw_mode.texbase_y = (option >> 4) & 0x1;
+    draw_mode.semi_trans = (option >> 5) & 0x3;
+    draw_mode.tex_colors = (option >> 7) & 0x3;
+    draw_mode.tex_rect_x_flip = option & (1 << 12);
+    draw_mode.tex_rect_y_flip = option & (1 << 13);
+}
+
+void GPU::gp0_tex_window(const uint32_t* words, uint16_t)
+{
+    uint32_t option = words[0] & 0xFFFFFF;
+    printf("[GPU] Tex window: $%08X\n", option);
+    tex_window.mask_x = option & 0x1F;
+    tex_window.mask_y = (option >> 5) & 0x1F;
+    tex_window.offset_x = (option >> 10) & 0x1F;
+    tex_window.offset_y = (option >> 15) & 0x1F;
+}
+
+void GPU::gp0_clip_top_left(const uint32_t* words, uint16_t)
+{
+    uint32_t option = words[0] & 0xFFFFFF;
+    printf("[GPU] Top-left clip: $%08X\n", option);
+    clip_area.x1 = option & 0x3FF;
+    clip_area.y1 = (option >> 10) & 0x1FF;
+}
+
+void GPU::gp0_clip_bottom_right(const uint32_t* words, uint16_t)
+{
+    uint32_t option = words[0] & 0xFFFFFF;
+    printf("[GPU] Bottom-right clip: $%08X\n", option);
+    clip_area.x2 = option & 0x3FF;
+    clip_area.y2 = (option >> 10) & 0x1FF;
+    printf("(%d, %d) (%d, %d)\n", clip_area.x1, clip_area.y1, clip_area.x2, clip_area.y2);
+}
+
+void GPU::gp0_draw_offset(const uint32_t* words, uint16_t)
+{
+    uint32_t option = words[0] & 0xFFFFFF;
+    printf("[GPU] Draw offset: $%08X\n", option);
+    draw_offset.x = ((int16_t)((option & 0x7FF) << 4)) >> 4;
+    draw_offset.y = ((int16_t)(((option >> 11) & 0x7FF) << 4)) >> 4;
+}
+
+void GPU::gp0_mask_bit(const uint32_t* words, uint16_t)
+{
+    uint32_t option = words[0] & 0xFFFFFF;
+    printf("[GPU] Mask Bit: $%08X\n", option);
+    force_mask_draw = option & 0x1;
+    check_mask = option & (1 << 1);
 }
 
 void GPU::write_GP1(uint32_t value)
 {
     //printf("[GPU] Write GP1: $%08X\n", value);
-    cmd = value >> 24;
-    option = value & 0xFFFFFF;
-    switch (cmd)
+    uint8_t command = value >> 24;
+    uint32_t command_option = value & 0xFFFFFF;
+    switch (command)
     {
         case 0x00:
             printf("[GPU] Reset\n");
@@ -658,7 +1495,8 @@ void GPU::write_GP1(uint32_t value)
             break;
         case 0x01:
             printf("[GPU] Reset command buffer\n");
-            cmd_params = 0;
+            packet_size = 0;
+            polyline = false;
             stat.ready_cmd = true;
             break;
         case 0x02:
@@ -667,28 +1505,46 @@ void GPU::write_GP1(uint32_t value)
             break;
         case 0x03:
             printf("[GPU] Display enable\n");
+            if (display_enabled != !(value & 0x1))
+                full_redraw = true;
             display_enabled = !(value & 0x1);
             break;
         case 0x04:
-            printf("[GPU] DMA dir: $%08X\n", option);
-            transfer_dir = option & 0x3;
+            printf("[GPU] DMA dir: $%08X\n", command_option);
+            transfer_dir = command_option & 0x3;
             break;
         case 0x05:
-            printf("[GPU] Display start: $%08X\n", option);
+            printf("[GPU] Display start: $%08X\n", command_option);
             display_start.x = value & 0x3FF;
             display_start.y = (value >> 10) & 0x1FF;
+            full_redraw = true;
             break;
         case 0x06:
-            printf("[GPU] Horizontal range: $%08X\n", option);
+            printf("[GPU] Horizontal range: $%08X\n", command_option);
+            display_range.x1 = command_option & 0xFFF;
+            display_range.x2 = (command_option >> 12) & 0xFFF;
+            update_display_area();
             break;
         case 0x07:
-            printf("[GPU] Vertical range: $%08X\n", option);
+            printf("[GPU] Vertical range: $%08X\n", command_option);
+            display_range.y1 = command_option & 0x3FF;
+            display_range.y2 = (command_option >> 10) & 0x3FF;
+            update_display_area();
             break;
         case 0x08:
-            printf("[GPU] Display mode: $%08X\n", option);
+            printf("[GPU] Display mode: $%08X\n", command_option);
+            if (display_mode.color_24bit != (bool)(command_option & (1 << 4)))
+                full_redraw = true;
+            display_mode.h_res = command_option & 0x3;
+            display_mode.v_res_480 = command_option & (1 << 2);
+            display_mode.PAL = command_option & (1 << 3);
+            display_mode.color_24bit = command_option & (1 << 4);
+            display_mode.interlaced = command_option & (1 << 5);
+            display_mode.h_res_368 = command_option & (1 << 6);
+            update_display_area();
             break;
         default:
-            printf("[GPU] Unrecognized GP1 command $%02X! ($%08X)\n", cmd, value);
+            printf("[GPU] Unrecognized GP1 command $%02X! ($%08X)\n", command, value);
             exit(1);
      }
 }
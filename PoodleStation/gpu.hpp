@@ -1,6 +1,21 @@
 #ifndef GPU_HPP
 #define GPU_HPP
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "gp0fifo.hpp"
+#include "scanout.hpp"
+#include "texcache.hpp"
+#include "threadpool.hpp"
+
+//Tiled rasterization splits the 1024x512 VRAM into square bins
+#define TILE_SIZE 32
+#define TILES_X (1024 / TILE_SIZE)
+#define TILES_Y (512 / TILE_SIZE)
+#define MAX_BATCH_SIZE 4096
 
 struct GPUSTAT
 {
@@ -39,6 +54,30 @@ struct DisplayStart
     uint16_t y; //scanlines
 };
 
+struct DisplayMode
+{
+    uint8_t h_res; //256, 320, 512 or 640 pixels
+    bool h_res_368; //Overrides h_res
+    bool v_res_480; //Only with interlacing
+    bool PAL;
+    bool color_24bit;
+    bool interlaced;
+};
+
+struct DisplayRange
+{
+    uint16_t x1, x2; //in GPU clock cycles
+    uint16_t y1, y2; //scanlines
+};
+
+//Rectangle of a VRAM transfer, and how far into it the transfer has gotten
+struct VRAMTransfer
+{
+    uint16_t x, y;
+    uint32_t w, h;
+    uint32_t col, row;
+};
+
 struct Vertex
 {
     int16_t x, y;
@@ -51,6 +90,59 @@ struct Vertex
     void set_texcoords(uint32_t param);
 };
 
+enum PRIMITIVE_TYPE
+{
+    PRIM_TRIANGLE,
+    PRIM_RECTANGLE,
+    PRIM_LINE
+};
+
+//A primitive with all state it depends on captured, so it can be rasterized later or in pieces
+struct Primitive
+{
+    PRIMITIVE_TYPE type;
+    Vertex v[3]; //Triangles: draw offset applied and counter-clockwise. Rectangles: v[0] is the top-left corner
+                 //Lines: v[0] and v[1] are the endpoints
+    ClipArea bounds; //Bounding box intersected with the clip area
+
+    bool textured;
+    uint32_t texpage_x, texpage_y;
+    uint16_t palette;
+    uint8_t color_depth;
+    const uint16_t* texels;
+};
+
+class GPU;
+
+//GP0 opcode properties
+#define GP0_RAW_TEXTURE (1 << 0)
+#define GP0_SEMI_TRANS (1 << 1)
+#define GP0_TEXTURED (1 << 2)
+#define GP0_QUAD (1 << 3)
+#define GP0_SHADED (1 << 4)
+#define GP0_POLYLINE (1 << 5)
+#define GP0_VRAM_WRITE (1 << 6) //Followed by CPU->VRAM data words
+#define GP0_IMMEDIATE (1 << 7) //Runs on the emulation thread instead of going through the FIFO
+#define GP0_STAT (1 << 8) //Changes GPUSTAT bits
+#define GP0_DRAW (1 << 9) //Rasterizes something, so it can be dropped when skipping a frame
+
+//Handlers get the whole packet, command word first
+typedef void (GPU::*GP0Handler)(const uint32_t* words, uint16_t flags);
+
+struct GP0Command
+{
+    uint8_t params;
+    uint16_t flags;
+    GP0Handler handler;
+};
+
+struct GP0Table
+{
+    GP0Command ops[256];
+};
+
+constexpr GP0Table build_GP0_table();
+
 struct RenderContext
 {
     uint16_t palette;
@@ -64,7 +156,7 @@ class GPU
 {
     private:
         uint8_t* VRAM;
-        uint32_t* framebuffer;
+        TextureCache tex_cache;
         DrawMode draw_mode;
         ClipArea clip_area;
         DrawOffset draw_offset;
@@ -75,21 +167,59 @@ class GPU
         bool is_odd_frame;
 
         DisplayStart display_start;
+        DisplayMode display_mode;
+        DisplayRange display_range;
+        int display_w, display_h;
+
+        //VRAM blocks written since the last frame was converted, in the texture cache's 64x16 layout
+        uint16_t display_dirty[TEXCACHE_BLOCK_ROWS];
+        bool full_redraw;
+        ScanoutStage scanout;
+
+        //Frameskip: drawing commands are dropped for the whole frame between two VBLANKs, while state changes,
+        //fills, copies and transfers still go through so the next drawn frame comes out right
+        bool skip_draw;
+        bool skip_next;
 
         GPUSTAT stat;
-        uint32_t params[20];
-        uint8_t cmd;
-        uint32_t option;
-        int cmd_params;
         int params_needed;
 
+        //Command packet being assembled from GP0 writes, command word first
+        uint32_t packet[16];
+        int packet_size;
+        bool polyline;
+        uint32_t transfer_words_left;
+
+        //GPUSTAT bits 0-12 as last written through GP0, kept apart from the render state for threaded mode
+        uint16_t stat_draw_mode;
+
+        bool threaded;
+        GP0FIFO fifo;
+        std::thread render_thread;
+        std::mutex render_mutex;
+        std::condition_variable render_wake;
+        std::condition_variable render_idle;
+        std::atomic<bool> render_sleeping;
+        bool render_stop;
+
+        bool tiled;
+        ThreadPool tile_pool;
+        std::vector<Primitive> batch;
+        std::vector<uint16_t> tile_bins[TILES_X * TILES_Y];
+        std::vector<int> active_tiles;
+        uint16_t batch_draw_blocks[TEXCACHE_BLOCK_ROWS];
+        uint16_t batch_tex_blocks[TEXCACHE_BLOCK_ROWS];
+        const uint16_t* batch_pages[TEXCACHE_ENTRIES];
+        int batch_page_count;
+        std::atomic<bool> batch_pending;
+
         bool IRQ;
 
         uint32_t transfer_dir;
 
-        uint16_t transfer_x, transfer_y;
-        uint32_t transfer_w, transfer_h;
-        uint32_t transfer_x_bound;
+        //Writes advance on the render thread and reads on the emulation thread, so each has its own cursor
+        VRAMTransfer write_cursor;
+        VRAMTransfer read_cursor;
         uint32_t transfer_size;
         bool read_transfer;
         bool write_transfer;
@@ -97,27 +227,77 @@ class GPU
         bool display_enabled;
 
         void transfer_to_VRAM();
+        void mark_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+        void update_display_area();
+        static void start_transfer(const uint32_t* words, VRAMTransfer& cursor);
+        void write_VRAM_pixels(const uint16_t* pixels, uint32_t count);
+        void read_VRAM_pixels(uint16_t* pixels, uint32_t count);
+
+        void update_stat_draw_mode(uint32_t value);
+        void end_packet();
+        void submit_packet(const uint32_t* words, int count, uint32_t flags);
+        void exec_command(const uint32_t* words);
+        void render_loop();
+        void sync();
 
-        int32_t orient2D(Vertex& v1, Vertex& v2, Vertex& v3);
-        void draw_quad(bool textured, bool shaded);
+        int32_t orient2D(const Vertex& v1, const Vertex& v2, const Vertex& v3);
+        bool clip_bounds(Primitive& prim, int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y);
         void draw_tri(Vertex vertices[]);
+        void draw_line(Vertex vertices[]);
         void draw_rect(Vertex& corner, int width, int height);
+        void draw_primitive(Primitive& prim);
+        void rasterize(const Primitive& prim, const ClipArea& area);
+        void rasterize_tri(const Primitive& prim, const ClipArea& area);
+        void rasterize_rect(const Primitive& prim, const ClipArea& area);
+        void rasterize_line(const Primitive& prim, const ClipArea& area);
         void draw_pixel(uint16_t x, uint16_t y, uint32_t color);
 
-        uint16_t tex_lookup(uint32_t texpage_x, uint32_t texpage_y, uint8_t s, uint8_t t, uint8_t color_depth);
+        void texture_blocks(const Primitive& prim, uint16_t* blocks);
+        void bin_primitive(Primitive& prim);
+        void flush_batch();
+
+        const uint16_t* get_texture(uint32_t texpage_x, uint32_t texpage_y, uint16_t palette, uint8_t color_depth);
+        uint16_t tex_lookup(const uint16_t* texels, uint32_t texpage_x, uint32_t texpage_y, uint8_t s, uint8_t t);
+
+        friend constexpr GP0Table build_GP0_table();
+        void gp0_nop(const uint32_t* words, uint16_t flags);
+        void gp0_clear_cache(const uint32_t* words, uint16_t flags);
+        void gp0_fill(const uint32_t* words, uint16_t flags);
+        void gp0_IRQ(const uint32_t* words, uint16_t flags);
+        void gp0_polygon(const uint32_t* words, uint16_t flags);
+        void gp0_line(const uint32_t* words, uint16_t flags);
+        void gp0_rect(const uint32_t* words, uint16_t flags);
+        void gp0_copy(const uint32_t* words, uint16_t flags);
+        void gp0_write_VRAM(const uint32_t* words, uint16_t flags);
+        void gp0_read_VRAM(const uint32_t* words, uint16_t flags);
+        void gp0_draw_mode(const uint32_t* words, uint16_t flags);
+        void gp0_tex_window(const uint32_t* words, uint16_t flags);
+        void gp0_clip_top_left(const uint32_t* words, uint16_t flags);
+        void gp0_clip_bottom_right(const uint32_t* words, uint16_t flags);
+        void gp0_draw_offset(const uint32_t* words, uint16_t flags);
+        void gp0_mask_bit(const uint32_t* words, uint16_t flags);
     public:
         GPU();
         ~GPU();
 
-        uint32_t* get_framebuffer();
+        void get_resolution(int& w, int& h);
+        double get_field_rate();
         void reset();
+        void set_threaded(bool threaded);
+        void set_tiled(bool tiled);
         void new_frame();
 
         void render_frame();
+        void set_frame_output(FrameMailbox* mailbox, std::function<void()> frame_ready);
+        void set_output_size(int w, int h);
+        void set_scale_mode(SCALE_MODE mode);
+        void set_skip_frame(bool skip);
 
         uint32_t read_response();
+        void read_response_block(uint32_t* words, int count);
         uint32_t read_stat();
         void write_GP0(uint32_t value);
+        void write_GP0_packet(const uint32_t* words, int count);
         void write_GP1(uint32_t value);
 };
 
@@ -1,13 +1,859 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include "gte.hpp"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+//Every element times the matching vector component. Each 16x16 product fits in 32 bits, so this is exact;
+//the sums are left to the caller, which has to check for overflow after each term.
+static void multiply_products(const GTE_Matrix& mat, const int16_t* vec, int32_t products[3][4])
+{
+#ifdef __SSE2__
+    //mullo/mulhi give the low and high halves of the products, and interleaving them gives the full ones
+    __m128i v = _mm_loadl_epi64((const __m128i*)vec);
+    v = _mm_unpacklo_epi64(v, v);
+
+    __m128i rows = _mm_loadu_si128((const __m128i*)mat.m[0]);
+    __m128i lo = _mm_mullo_epi16(rows, v);
+    __m128i hi = _mm_mulhi_epi16(rows, v);
+    _mm_storeu_si128((__m128i*)products[0], _mm_unpacklo_epi16(lo, hi));
+    _mm_storeu_si128((__m128i*)products[1], _mm_unpackhi_epi16(lo, hi));
+
+    rows = _mm_loadl_epi64((const __m128i*)mat.m[2]);
+    lo = _mm_mullo_epi16(rows, v);
+    hi = _mm_mulhi_epi16(rows, v);
+    _mm_storeu_si128((__m128i*)products[2], _mm_unpacklo_epi16(lo, hi));
+#else
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            products[i][j] = mat.m[i][j] * vec[j];
+    }
+#endif
+}
+
+struct UNRTable
+{
+    uint8_t seeds[0x101];
+};
+
+//Seeds for the reciprocal in GTE::divide
+constexpr UNRTable build_UNR_table()
+{
+    UNRTable table = {};
+    for (int i = 0; i < 0x101; i++)
+    {
+        int seed = (0x40000 / (i + 0x100) + 1) / 2 - 0x101;
+        table.seeds[i] = (seed > 0) ? seed : 0;
+    }
+    return table;
+}
+
+static constexpr UNRTable UNR_TABLE = build_UNR_table();
+
+static int leading_zeros16(uint16_t value)
+{
+#ifdef __GNUC__
+    return __builtin_clz((uint32_t)value | 1) - 16;
+#else
+    int count = 0;
+    while (count < 15 && !(value & (0x8000 >> count)))
+        count++;
+    return count;
+#endif
+}
+
+static uint32_t pack(int16_t lo, int16_t hi)
+{
+    return (uint16_t)lo | ((uint32_t)(uint16_t)hi << 16);
+}
+
+//The nine elements of a matrix are packed two to a register, with the last one alone and sign-extended
+static uint32_t read_matrix(const GTE_Matrix& mat, int index)
+{
+    int a = index * 2;
+    int b = a + 1;
+    if (index == 4)
+        return (int32_t)mat.m[2][2];
+    return pack(mat.m[a / 3][a % 3], mat.m[b / 3][b % 3]);
+}
+
+static void write_matrix(GTE_Matrix& mat, int index, uint32_t value)
+{
+    int a = index * 2;
+    int b = a + 1;
+    mat.m[a / 3][a % 3] = (int16_t)value;
+    if (index < 4)
+        mat.m[b / 3][b % 3] = (int16_t)(value >> 16);
+}
+
+template <std::size_t... index>
+constexpr MVMVATable build_MVMVA_table(std::index_sequence<index...>)
+{
+    return {{&GTE::mvmva<(index >> 4) & 0x3, (index >> 2) & 0x3, index & 0x3>...}};
+}
+
+static constexpr MVMVATable MVMVA_TABLE = build_MVMVA_table(std::make_index_sequence<64>());
+
+constexpr GTETable build_GTE_table()
+{
+    GTETable table = {};
+    for (int i = 0; i < 64; i++)
+        table.ops[i] = &GTE::unknown;
+
+    table.ops[0x01] = &GTE::rtps;
+    table.ops[0x06] = &GTE::nclip;
+    table.ops[0x0C] = &GTE::op;
+    table.ops[0x10] = &GTE::dpcs;
+    table.ops[0x11] = &GTE::intpl;
+    table.ops[0x12] = &GTE::mvmva;
+    table.ops[0x13] = &GTE::ncds;
+    table.ops[0x14] = &GTE::cdp;
+    table.ops[0x16] = &GTE::ncdt;
+    table.ops[0x1B] = &GTE::nccs;
+    table.ops[0x1C] = &GTE::cc;
+    table.ops[0x1E] = &GTE::ncs;
+    table.ops[0x20] = &GTE::nct;
+    table.ops[0x28] = &GTE::sqr;
+    table.ops[0x29] = &GTE::dcpl;
+    table.ops[0x2A] = &GTE::dpct;
+    table.ops[0x2D] = &GTE::avsz3;
+    table.ops[0x2E] = &GTE::avsz4;
+    table.ops[0x30] = &GTE::rtpt;
+    table.ops[0x3D] = &GTE::gpf;
+    table.ops[0x3E] = &GTE::gpl;
+    table.ops[0x3F] = &GTE::ncct;
+    return table;
+}
+
+static constexpr GTETable GTE_TABLE = build_GTE_table();
+
 GTE::GTE()
 {
 
 }
 
+void GTE::reset()
+{
+    memset(V, 0, sizeof(V));
+    memset(RGBC, 0, sizeof(RGBC));
+    OTZ = 0;
+    memset(IR, 0, sizeof(IR));
+    memset(SXY, 0, sizeof(SXY));
+    memset(SZ, 0, sizeof(SZ));
+    memset(RGB, 0, sizeof(RGB));
+    RES1 = 0;
+    memset(MAC, 0, sizeof(MAC));
+    LZCS = 0;
+    LZCR = 32;
+
+    memset(&rotation, 0, sizeof(rotation));
+    memset(&light, 0, sizeof(light));
+    memset(&light_color, 0, sizeof(light_color));
+    memset(TR, 0, sizeof(TR));
+    memset(BK, 0, sizeof(BK));
+    memset(FC, 0, sizeof(FC));
+    OFX = 0;
+    OFY = 0;
+    H = 0;
+    DQA = 0;
+    DQB = 0;
+    ZSF3 = 0;
+    ZSF4 = 0;
+    FLAG = 0;
+
+    shift = 0;
+    lm = false;
+}
+
+uint32_t GTE::mfc(int index)
+{
+    switch (index)
+    {
+        case 0:
+        case 2:
+        case 4:
+            return pack(V[index / 2][0], V[index / 2][1]);
+        case 1:
+        case 3:
+        case 5:
+            return (int32_t)V[index / 2][2];
+        case 6:
+            return RGBC[0] | (RGBC[1] << 8) | (RGBC[2] << 16) | (RGBC[3] << 24);
+        case 7:
+            return OTZ;
+        case 8:
+        case 9:
+        case 10:
+        case 11:
+            return (int32_t)IR[index - 8];
+        case 12:
+        case 13:
+        case 14:
+            return pack(SXY[index - 12][0], SXY[index - 12][1]);
+        case 15:
+            return pack(SXY[2][0], SXY[2][1]);
+        case 16:
+        case 17:
+        case 18:
+        case 19:
+            return SZ[index - 16];
+        case 20:
+        case 21:
+        case 22:
+        {
+            uint8_t* color = RGB[index - 20];
+            return color[0] | (color[1] << 8) | (color[2] << 16) | (color[3] << 24);
+        }
+        case 23:
+            return RES1;
+        case 24:
+        case 25:
+        case 26:
+        case 27:
+            return MAC[index - 24];
+        case 28:
+        case 29:
+        {
+            //IR1-3 squeezed back into a 15-bit color
+            uint32_t value = 0;
+            for (int i = 0; i < 3; i++)
+            {
+                int32_t component = min(max(IR[i + 1] >> 7, 0), 0x1F);
+                value |= component << (i * 5);
+            }
+            return value;
+        }
+        case 30:
+            return LZCS;
+        default:
+            return LZCR;
+    }
+}
+
+void GTE::mtc(int index, uint32_t value)
+{
+    switch (index)
+    {
+        case 0:
+        case 2:
+        case 4:
+            V[index / 2][0] = (int16_t)value;
+            V[index / 2][1] = (int16_t)(value >> 16);
+            break;
+        case 1:
+        case 3:
+        case 5:
+            V[index / 2][2] = (int16_t)value;
+            break;
+        case 6:
+            for (int i = 0; i < 4; i++)
+                RGBC[i] = value >> (i * 8);
+            break;
+        case 7:
+            OTZ = value & 0xFFFF;
+            break;
+        case 8:
+        case 9:
+        case 10:
+        case 11:
+            IR[index - 8] = (int16_t)value;
+            break;
+        case 12:
+        case 13:
+        case 14:
+            SXY[index - 12][0] = (int16_t)value;
+            SXY[index - 12][1] = (int16_t)(value >> 16);
+            break;
+        case 15:
+            //Writing SXYP pushes onto the FIFO
+            memcpy(SXY[0], SXY[1], sizeof(SXY[0]));
+            memcpy(SXY[1], SXY[2], sizeof(SXY[1]));
+            SXY[2][0] = (int16_t)value;
+            SXY[2][1] = (int16_t)(value >> 16);
+            break;
+        case 16:
+        case 17:
+        case 18:
+        case 19:
+            SZ[index - 16] = value & 0xFFFF;
+            break;
+        case 20:
+        case 21:
+        case 22:
+            for (int i = 0; i < 4; i++)
+                RGB[index - 20][i] = value >> (i * 8);
+            break;
+        case 23:
+            RES1 = value;
+            break;
+        case 24:
+        case 25:
+        case 26:
+        case 27:
+            MAC[index - 24] = value;
+            break;
+        case 28:
+            for (int i = 0; i < 3; i++)
+                IR[i + 1] = ((value >> (i * 5)) & 0x1F) << 7;
+            break;
+        case 30:
+        {
+            //LZCR counts the leading bits that match the sign bit
+            LZCS = value;
+            uint32_t bits = (value & 0x80000000) ? ~value : value;
+            LZCR = 0;
+            while (LZCR < 32 && !(bits & (0x80000000 >> LZCR)))
+                LZCR++;
+            break;
+        }
+        default:
+            //ORGB and LZCR are read-only
+            break;
+    }
+}
+
+uint32_t GTE::cfc(int index)
+{
+    if (index < 5)
+        return read_matrix(rotation, index);
+    if (index < 8)
+        return TR[index - 5];
+    if (index < 13)
+        return read_matrix(light, index - 8);
+    if (index < 16)
+        return BK[index - 13];
+    if (index < 21)
+        return read_matrix(light_color, index - 16);
+    if (index < 24)
+        return FC[index - 21];
+
+    switch (index)
+    {
+        case 24:
+            return OFX;
+        case 25:
+            return OFY;
+        case 26:
+            //H is unsigned, but reads back sign-extended
+            return (int32_t)(int16_t)H;
+        case 27:
+            return (int32_t)DQA;
+        case 28:
+            return DQB;
+        case 29:
+            return (int32_t)ZSF3;
+        case 30:
+            return (int32_t)ZSF4;
+        default:
+            return FLAG;
+    }
+}
+
 void GTE::ctc(int index, uint32_t value)
 {
-    printf("[GTE] CTC: %d, $%08X\n", index, value);
+    if (index < 5)
+        write_matrix(rotation, index, value);
+    else if (index < 8)
+        TR[index - 5] = value;
+    else if (index < 13)
+        write_matrix(light, index - 8, value);
+    else if (index < 16)
+        BK[index - 13] = value;
+    else if (index < 21)
+        write_matrix(light_color, index - 16, value);
+    else if (index < 24)
+        FC[index - 21] = value;
+    else
+    {
+        switch (index)
+        {
+            case 24:
+                OFX = value;
+                break;
+            case 25:
+                OFY = value;
+                break;
+            case 26:
+                H = value & 0xFFFF;
+                break;
+            case 27:
+                DQA = (int16_t)value;
+                break;
+            case 28:
+                DQB = value;
+                break;
+            case 29:
+                ZSF3 = (int16_t)value;
+                break;
+            case 30:
+                ZSF4 = (int16_t)value;
+                break;
+            default:
+                FLAG = value & 0x7FFFF000;
+                if (FLAG & 0x7F87E000)
+                    FLAG |= 0x80000000;
+                break;
+        }
+    }
+}
+
+void GTE::execute(uint32_t instruction)
+{
+    //sf and lm are shared by every command and stay runtime state; only MVMVA's operand selectors are specialized
+    shift = (instruction & (1 << 19)) ? 12 : 0;
+    lm = instruction & (1 << 10);
+    FLAG = 0;
+
+    (this->*GTE_TABLE.ops[instruction & 0x3F])(instruction);
+
+    //Bit 31 summarizes the flags that count as errors
+    if (FLAG & 0x7F87E000)
+        FLAG |= 0x80000000;
+}
+
+//MAC1-3 are 44 bits wide internally; anything past that sets a flag and wraps
+int64_t GTE::check_MAC(int index, int64_t value)
+{
+    if (value > 0x7FFFFFFFFFFLL)
+        FLAG |= 1 << (31 - index);
+    else if (value < -0x80000000000LL)
+        FLAG |= 1 << (28 - index);
+    return (int64_t)((uint64_t)value << 20) >> 20;
+}
+
+int32_t GTE::check_MAC0(int64_t value)
+{
+    if (value > 0x7FFFFFFFLL)
+        FLAG |= 1 << 16;
+    else if (value < -0x80000000LL)
+        FLAG |= 1 << 15;
+    return (int32_t)value;
+}
+
+int16_t GTE::saturate_IR(int index, int32_t value, bool lm)
+{
+    int32_t min = lm ? 0 : -0x8000;
+    if (value < min)
+    {
+        FLAG |= 1 << (25 - index);
+        return min;
+    }
+    if (value > 0x7FFF)
+    {
+        FLAG |= 1 << (25 - index);
+        return 0x7FFF;
+    }
+    return value;
+}
+
+void GTE::set_MAC_IR(int index, int64_t value, bool lm)
+{
+    value = check_MAC(index, value);
+    MAC[index] = (int32_t)(value >> shift);
+    IR[index] = saturate_IR(index, MAC[index], lm);
+}
+
+void GTE::push_SZ(int32_t value)
+{
+    if (value < 0)
+    {
+        value = 0;
+        FLAG |= 1 << 18;
+    }
+    else if (value > 0xFFFF)
+    {
+        value = 0xFFFF;
+        FLAG |= 1 << 18;
+    }
+    SZ[0] = SZ[1];
+    SZ[1] = SZ[2];
+    SZ[2] = SZ[3];
+    SZ[3] = value;
+}
+
+void GTE::push_SXY(int32_t x, int32_t y)
+{
+    if (x < -0x400 || x > 0x3FF)
+    {
+        x = min(max(x, -0x400), 0x3FF);
+        FLAG |= 1 << 14;
+    }
+    if (y < -0x400 || y > 0x3FF)
+    {
+        y = min(max(y, -0x400), 0x3FF);
+        FLAG |= 1 << 13;
+    }
+    memcpy(SXY[0], SXY[1], sizeof(SXY[0]));
+    memcpy(SXY[1], SXY[2], sizeof(SXY[1]));
+    SXY[2][0] = x;
+    SXY[2][1] = y;
+}
+
+void GTE::push_color()
+{
+    memcpy(RGB[0], RGB[1], sizeof(RGB[0]));
+    memcpy(RGB[1], RGB[2], sizeof(RGB[1]));
+    for (int i = 0; i < 3; i++)
+    {
+        int32_t value = MAC[i + 1] >> 4;
+        if (value < 0 || value > 0xFF)
+        {
+            value = min(max(value, 0), 0xFF);
+            FLAG |= 1 << (21 - i);
+        }
+        RGB[2][i] = value;
+    }
+    RGB[2][3] = RGBC[3];
+}
+
+//H / z as 1.16 fixed point, done the way the hardware does it: a reciprocal seeded from a table
+//and refined with Newton-Raphson, so results can be slightly off from a true division.
+//There are no branches, as depths are all over the place and the overflow case would mispredict.
+uint32_t GTE::divide(uint16_t z)
+{
+    uint32_t overflow = H >= z * 2;
+    FLAG |= overflow << 17;
+
+    //Normalizing sets bit 15 of d. A depth of zero always overflows; forcing the bit on just keeps the lookup in range.
+    int zeros = leading_zeros16(z);
+    uint32_t n = H << zeros;
+    uint32_t d = (z << zeros) | 0x8000;
+    uint32_t u = UNR_TABLE.seeds[(d - 0x7FC0) >> 7] + 0x101;
+    d = (0x2000080 - (d * u)) >> 8;
+    d = (0x0000080 + (d * u)) >> 8;
+    uint32_t result = (uint32_t)(((uint64_t)n * d + 0x8000) >> 16);
+    result = min(result, (uint32_t)0x1FFFF);
+    return overflow ? 0x1FFFF : result;
+}
+
+//(tr * 0x1000 + mat * vec) for each row, unshifted. tr may be null for no translation.
+void GTE::mat_vec(const GTE_Matrix& mat, const int16_t* vec, const int32_t* tr, int64_t* sums)
+{
+    int32_t products[3][4];
+    multiply_products(mat, vec, products);
+    for (int i = 0; i < 3; i++)
+    {
+        int64_t sum = tr ? (int64_t)tr[i] * 0x1000 : 0;
+        sum = check_MAC(i + 1, sum + products[i][0]);
+        sum = check_MAC(i + 1, sum + products[i][1]);
+        sums[i] = check_MAC(i + 1, sum + products[i][2]);
+    }
+}
+
+void GTE::mat_vec_IR(const GTE_Matrix& mat, const int16_t* vec, const int32_t* tr)
+{
+    int64_t sums[3];
+    mat_vec(mat, vec, tr, sums);
+    for (int i = 0; i < 3; i++)
+        set_MAC_IR(i + 1, sums[i], lm);
+}
+
+//MAC = in + (FC - in) * IR0, for depth cueing towards the far color
+void GTE::interpolate(int64_t r, int64_t g, int64_t b)
+{
+    int64_t in[3] = {r, g, b};
+    for (int i = 0; i < 3; i++)
+        set_MAC_IR(i + 1, (int64_t)FC[i] * 0x1000 - in[i], false);
+    for (int i = 0; i < 3; i++)
+        set_MAC_IR(i + 1, (int64_t)IR[i + 1] * IR[0] + in[i], lm);
+}
+
+//Multiplies IR1-3 by RGBC, optionally depth cues the result, and pushes it as a color
+void GTE::color_product(bool depth_cue)
+{
+    int64_t r = (int64_t)RGBC[0] * IR[1] * 16;
+    int64_t g = (int64_t)RGBC[1] * IR[2] * 16;
+    int64_t b = (int64_t)RGBC[2] * IR[3] * 16;
+    if (depth_cue)
+        interpolate(r, g, b);
+    else
+    {
+        set_MAC_IR(1, r, lm);
+        set_MAC_IR(2, g, lm);
+        set_MAC_IR(3, b, lm);
+    }
+    push_color();
+}
+
+//Lights a normal: IR = BK + LCM * (LLM * vec)
+void GTE::normal_color(const int16_t* vec, bool use_color, bool depth_cue)
+{
+    mat_vec_IR(light, vec, nullptr);
+    int16_t ir[4] = {IR[1], IR[2], IR[3], 0};
+    mat_vec_IR(light_color, ir, BK);
+    if (use_color)
+        color_product(depth_cue);
+    else
+        push_color();
+}
+
+//First half of a perspective transform: rotates and translates a vertex, and pushes its depth
+void GTE::transform(int index)
+{
+    int64_t sums[3];
+    mat_vec(rotation, V[index], TR, sums);
+    set_MAC_IR(1, sums[0], lm);
+    set_MAC_IR(2, sums[1], lm);
+
+    //IR3 saturates as usual, but its flag is checked against the value shifted by 12 whatever sf says
+    int64_t z = sums[2] >> 12;
+    MAC[3] = (int32_t)(sums[2] >> shift);
+    IR[3] = min(max(MAC[3], lm ? 0 : -0x8000), 0x7FFF);
+    if (z < -0x8000 || z > 0x7FFF)
+        FLAG |= 1 << 22;
+
+    push_SZ((int32_t)z);
+}
+
+//Second half: scales the vertex by n, the reciprocal of its depth, onto the screen
+void GTE::project(uint32_t n, int16_t ir1, int16_t ir2)
+{
+    int64_t x = (int64_t)n * ir1 + OFX;
+    int64_t y = (int64_t)n * ir2 + OFY;
+    check_MAC0(x);
+    check_MAC0(y);
+    push_SXY((int32_t)(x >> 16), (int32_t)(y >> 16));
+}
+
+void GTE::depth_cue(uint32_t n)
+{
+    int64_t depth = (int64_t)n * DQA + DQB;
+    MAC[0] = check_MAC0(depth);
+    int32_t value = (int32_t)(depth >> 12);
+    if (value < 0 || value > 0x1000)
+    {
+        value = min(max(value, 0), 0x1000);
+        FLAG |= 1 << 12;
+    }
+    IR[0] = value;
+}
+
+void GTE::average_Z(int16_t factor, int32_t sum)
+{
+    int64_t value = (int64_t)factor * sum;
+    MAC[0] = check_MAC0(value);
+    value >>= 12;
+    if (value < 0 || value > 0xFFFF)
+    {
+        value = min(max(value, (int64_t)0), (int64_t)0xFFFF);
+        FLAG |= 1 << 18;
+    }
+    OTZ = value;
+}
+
+void GTE::unknown(uint32_t instruction)
+{
+    printf("[GTE] Unrecognized command $%02X\n", instruction & 0x3F);
+    exit(1);
+}
+
+void GTE::rtps(uint32_t)
+{
+    transform(0);
+    uint32_t n = divide(SZ[3]);
+    project(n, IR[1], IR[2]);
+    depth_cue(n);
+}
+
+void GTE::nclip(uint32_t)
+{
+    int64_t value = (int64_t)SXY[0][0] * SXY[1][1] + SXY[1][0] * SXY[2][1] + SXY[2][0] * SXY[0][1];
+    value -= (int64_t)SXY[0][0] * SXY[2][1] + SXY[1][0] * SXY[0][1] + SXY[2][0] * SXY[1][1];
+    MAC[0] = check_MAC0(value);
+}
+
+void GTE::op(uint32_t)
+{
+    //Cross product of IR with the rotation matrix diagonal
+    int64_t d1 = rotation.m[0][0];
+    int64_t d2 = rotation.m[1][1];
+    int64_t d3 = rotation.m[2][2];
+    int64_t ir1 = IR[1], ir2 = IR[2], ir3 = IR[3];
+    set_MAC_IR(1, ir3 * d2 - ir2 * d3, lm);
+    set_MAC_IR(2, ir1 * d3 - ir3 * d1, lm);
+    set_MAC_IR(3, ir2 * d1 - ir1 * d2, lm);
+}
+
+void GTE::dpcs(uint32_t)
+{
+    interpolate((int64_t)RGBC[0] << 16, (int64_t)RGBC[1] << 16, (int64_t)RGBC[2] << 16);
+    push_color();
+}
+
+void GTE::intpl(uint32_t)
+{
+    interpolate((int64_t)IR[1] * 0x1000, (int64_t)IR[2] * 0x1000, (int64_t)IR[3] * 0x1000);
+    push_color();
+}
+
+void GTE::mvmva(uint32_t instruction)
+{
+    (this->*MVMVA_TABLE.ops[(instruction >> 13) & 0x3F])(instruction);
+}
+
+//The operands are template parameters, so each combination gets its selection resolved at compile time
+template <int mx, int v, int cv>
+void GTE::mvmva(uint32_t)
+{
+    GTE_Matrix garbage;
+    const GTE_Matrix* mat = &rotation;
+    if (mx == 1)
+        mat = &light;
+    else if (mx == 2)
+        mat = &light_color;
+    else if (mx == 3)
+    {
+        //There is no fourth matrix; selecting it reads a mix of other registers
+        int16_t r = RGBC[0] << 4;
+        int16_t rt13 = rotation.m[0][2];
+        int16_t rt22 = rotation.m[1][1];
+        garbage = {{{(int16_t)-r, r, IR[0], 0}, {rt13, rt13, rt13, 0}, {rt22, rt22, rt22, 0}}};
+        mat = &garbage;
+    }
+
+    int16_t ir[4] = {IR[1], IR[2], IR[3], 0};
+    const int16_t* vec = (v == 3) ? ir : V[(v < 3) ? v : 0];
+
+    const int32_t* tr = nullptr;
+    if (cv == 0)
+        tr = TR;
+    else if (cv == 1)
+        tr = BK;
+    else if (cv == 2)
+    {
+        //The far color translation is broken: the translation and first column only end up in the flags
+        for (int i = 0; i < 3; i++)
+        {
+            int64_t first = check_MAC(i + 1, (int64_t)FC[i] * 0x1000 + mat->m[i][0] * vec[0]);
+            saturate_IR(i + 1, (int32_t)(first >> shift), false);
+        }
+        garbage = *mat;
+        for (int i = 0; i < 3; i++)
+            garbage.m[i][0] = 0;
+        mat = &garbage;
+    }
+
+    mat_vec_IR(*mat, vec, tr);
+}
+
+void GTE::ncds(uint32_t)
+{
+    normal_color(V[0], true, true);
+}
+
+void GTE::cdp(uint32_t)
+{
+    int16_t ir[4] = {IR[1], IR[2], IR[3], 0};
+    mat_vec_IR(light_color, ir, BK);
+    color_product(true);
+}
+
+void GTE::ncdt(uint32_t)
+{
+    for (int i = 0; i < 3; i++)
+        normal_color(V[i], true, true);
+}
+
+void GTE::nccs(uint32_t)
+{
+    normal_color(V[0], true, false);
+}
+
+void GTE::cc(uint32_t)
+{
+    int16_t ir[4] = {IR[1], IR[2], IR[3], 0};
+    mat_vec_IR(light_color, ir, BK);
+    color_product(false);
+}
+
+void GTE::ncs(uint32_t)
+{
+    normal_color(V[0], false, false);
+}
+
+void GTE::nct(uint32_t)
+{
+    for (int i = 0; i < 3; i++)
+        normal_color(V[i], false, false);
+}
+
+void GTE::sqr(uint32_t)
+{
+    for (int i = 1; i <= 3; i++)
+        set_MAC_IR(i, (int64_t)IR[i] * IR[i], lm);
+}
+
+void GTE::dcpl(uint32_t)
+{
+    color_product(true);
+}
+
+void GTE::dpct(uint32_t)
+{
+    //Works through the color FIFO, which every push moves along
+    for (int i = 0; i < 3; i++)
+    {
+        interpolate((int64_t)RGB[0][0] << 16, (int64_t)RGB[0][1] << 16, (int64_t)RGB[0][2] << 16);
+        push_color();
+    }
+}
+
+void GTE::avsz3(uint32_t)
+{
+    average_Z(ZSF3, SZ[1] + SZ[2] + SZ[3]);
+}
+
+void GTE::avsz4(uint32_t)
+{
+    average_Z(ZSF4, SZ[0] + SZ[1] + SZ[2] + SZ[3]);
+}
+
+void GTE::rtpt(uint32_t)
+{
+    //The three divisions don't depend on each other, so they're done back to back where the CPU can overlap them.
+    //Only the FIFOs see the order things happen in, and they get pushed in the same order as three RTPS would.
+    int16_t ir[3][2];
+    uint16_t z[3];
+    for (int i = 0; i < 3; i++)
+    {
+        transform(i);
+        ir[i][0] = IR[1];
+        ir[i][1] = IR[2];
+        z[i] = SZ[3];
+    }
+
+    uint32_t n[3];
+    for (int i = 0; i < 3; i++)
+        n[i] = divide(z[i]);
+
+    for (int i = 0; i < 3; i++)
+        project(n[i], ir[i][0], ir[i][1]);
+    depth_cue(n[2]);
+}
+
+void GTE::gpf(uint32_t)
+{
+    for (int i = 1; i <= 3; i++)
+        set_MAC_IR(i, (int64_t)IR[0] * IR[i], lm);
+    push_color();
+}
+
+void GTE::gpl(uint32_t)
+{
+    for (int i = 1; i <= 3; i++)
+        set_MAC_IR(i, (int64_t)MAC[i] * (1 << shift) + (int64_t)IR[0] * IR[i], lm);
+    push_color();
+}
+
+void GTE::ncct(uint32_t)
+{
+    for (int i = 0; i < 3; i++)
+        normal_color(V[i], true, false);
 }
@@ -1,13 +1,122 @@
 #ifndef GTE_HPP
 #define GTE_HPP
+#include <cstddef>
 #include <cstdint>
+#include <utility>
+
+//Rows are padded to four halfwords, so two rows fill an SSE register
+struct GTE_Matrix
+{
+    int16_t m[3][4];
+};
+
+class GTE;
+
+typedef void (GTE::*GTEHandler)(uint32_t instruction);
+
+//Indexed by the command number in the low six bits of the instruction
+struct GTETable
+{
+    GTEHandler ops[64];
+};
+
+//MVMVA comes in one version per matrix, vector and translation combination, indexed by instruction bits 13-18
+struct MVMVATable
+{
+    GTEHandler ops[64];
+};
+
+constexpr GTETable build_GTE_table();
 
 class GTE
 {
+    private:
+        //Data registers
+        int16_t V[3][4]; //x, y, z and padding
+        uint8_t RGBC[4];
+        uint16_t OTZ;
+        int16_t IR[4];
+        int16_t SXY[3][2];
+        uint16_t SZ[4];
+        uint8_t RGB[3][4];
+        uint32_t RES1;
+        int32_t MAC[4];
+        uint32_t LZCS, LZCR;
+
+        //Control registers
+        GTE_Matrix rotation;
+        GTE_Matrix light;
+        GTE_Matrix light_color;
+        int32_t TR[3];
+        int32_t BK[3];
+        int32_t FC[3];
+        int32_t OFX, OFY;
+        uint16_t H;
+        int16_t DQA;
+        int32_t DQB;
+        int16_t ZSF3, ZSF4;
+        uint32_t FLAG;
+
+        //Decoded from the command being executed
+        int shift;
+        bool lm;
+
+        int64_t check_MAC(int index, int64_t value);
+        int32_t check_MAC0(int64_t value);
+        int16_t saturate_IR(int index, int32_t value, bool lm);
+        void set_MAC_IR(int index, int64_t value, bool lm);
+        void push_SZ(int32_t value);
+        void push_SXY(int32_t x, int32_t y);
+        void push_color();
+        uint32_t divide(uint16_t z);
+
+        void mat_vec(const GTE_Matrix& mat, const int16_t* vec, const int32_t* tr, int64_t* sums);
+        void mat_vec_IR(const GTE_Matrix& mat, const int16_t* vec, const int32_t* tr);
+        void interpolate(int64_t r, int64_t g, int64_t b);
+        void color_product(bool depth_cue);
+        void normal_color(const int16_t* vec, bool use_color, bool depth_cue);
+        void transform(int index);
+        void project(uint32_t n, int16_t ir1, int16_t ir2);
+        void depth_cue(uint32_t n);
+        void average_Z(int16_t factor, int32_t sum);
+
+        template <std::size_t... index> friend constexpr MVMVATable build_MVMVA_table(std::index_sequence<index...>);
+        friend constexpr GTETable build_GTE_table();
+        void unknown(uint32_t instruction);
+        void rtps(uint32_t instruction);
+        void nclip(uint32_t instruction);
+        void op(uint32_t instruction);
+        void dpcs(uint32_t instruction);
+        void intpl(uint32_t instruction);
+        void mvmva(uint32_t instruction);
+        template <int mx, int v, int cv> void mvmva(uint32_t instruction);
+        void ncds(uint32_t instruction);
+        void cdp(uint32_t instruction);
+        void ncdt(uint32_t instruction);
+        void nccs(uint32_t instruction);
+        void cc(uint32_t instruction);
+        void ncs(uint32_t instruction);
+        void nct(uint32_t instruction);
+        void sqr(uint32_t instruction);
+        void dcpl(uint32_t instruction);
+        void dpct(uint32_t instruction);
+        void avsz3(uint32_t instruction);
+        void avsz4(uint32_t instruction);
+        void rtpt(uint32_t instruction);
+        void gpf(uint32_t instruction);
+        void gpl(uint32_t instruction);
+        void ncct(uint32_t instruction);
     public:
         GTE();
 
+        void reset();
+
+        uint32_t mfc(int index);
+        void mtc(int index, uint32_t value);
+        uint32_t cfc(int index);
         void ctc(int index, uint32_t value);
+
+        void execute(uint32_t instruction);
 };
 
 #endif // GTE_HPP
@@ -99,6 +99,12 @@ void Interpreter::interpret(CPU &cpu, uint32_t instruction)
         case 0x2E:
             swr(cpu, instruction);
             break;
+        case 0x32:
+            lwc2(cpu, instruction);
+            break;
+        case 0x3A:
+            swc2(cpu, instruction);
+            break;
         default:
             unknown_op("regular", op, instruction);
     }
@@ -784,6 +790,14 @@ void Interpreter::cop(CPU &cpu, uint32_t instruction)
 {
     int op = (instruction >> 21) & 0x1F;
     uint8_t cop_id = ((instruction >> 26) & 0x3);
+
+    //GTE commands have bit 25 set; the rest of the word is the command and its options
+    if (cop_id == 2 && (op & 0x10))
+    {
+        cpu.cop2_command(instruction);
+        return;
+    }
+
     op |= cop_id << 8;
     switch (op)
     {
@@ -796,6 +810,15 @@ void Interpreter::cop(CPU &cpu, uint32_t instruction)
         case 0x010:
             cpu.rfe();
             break;
+        case 0x200:
+            mfc(cpu, instruction);
+            break;
+        case 0x202:
+            cfc(cpu, instruction);
+            break;
+        case 0x204:
+            mtc(cpu, instruction);
+            break;
         case 0x206:
             ctc(cpu, instruction);
             break;
@@ -820,6 +843,14 @@ void Interpreter::mtc(CPU &cpu, uint32_t instruction)
     cpu.mtc(cop_id, cop_reg, reg);
 }
 
+void Interpreter::cfc(CPU &cpu, uint32_t instruction)
+{
+    uint8_t cop_id = (instruction >> 26) & 0x3;
+    uint8_t reg = (instruction >> 16) & 0x1F;
+    uint8_t cop_reg = (instruction >> 11) & 0x1F;
+    cpu.cfc(cop_id, cop_reg, reg);
+}
+
 void Interpreter::ctc(CPU &cpu, uint32_t instruction)
 {
     uint8_t cop_id = (instruction >> 26) & 0x3;
@@ -828,6 +859,26 @@ void Interpreter::ctc(CPU &cpu, uint32_t instruction)
     cpu.ctc(cop_id, cop_reg, reg);
 }
 
+void Interpreter::lwc2(CPU &cpu, uint32_t instruction)
+{
+    int16_t offset = (int16_t)(instruction & 0xFFFF);
+    uint32_t cop_reg = (instruction >> 16) & 0x1F;
+    uint32_t base = (instruction >> 21) & 0x1F;
+    uint32_t addr = cpu.get_gpr(base);
+    addr += offset;
+    cpu.lwc(2, cop_reg, addr);
+}
+
+void Interpreter::swc2(CPU &cpu, uint32_t instruction)
+{
+    int16_t offset = (int16_t)(instruction & 0xFFFF);
+    uint32_t cop_reg = (instruction >> 16) & 0x1F;
+    uint32_t base = (instruction >> 21) & 0x1F;
+    uint32_t addr = cpu.get_gpr(base);
+    addr += offset;
+    cpu.swc(2, cop_reg, addr);
+}
+
 void Interpreter::unknown_op(const char *type, uint16_t op, uint32_t instruction)
 {
     printf("\n[Interpreter] Unrecognized %s op $%02X\n", type, op);
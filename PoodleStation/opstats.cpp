@@ -0,0 +1,149 @@
+#include <cstdio>
+#include <cstring>
+#include "opstats.hpp"
+
+using namespace std;
+
+struct OpcodeName
+{
+    int index;
+    const char* name;
+};
+
+static const OpcodeName REGULAR_NAMES[] =
+{
+    {0x02, "j"}, {0x03, "jal"}, {0x04, "beq"}, {0x05, "bne"}, {0x06, "blez"}, {0x07, "bgtz"},
+    {0x08, "addi"}, {0x09, "addiu"}, {0x0A, "slti"}, {0x0B, "sltiu"},
+    {0x0C, "andi"}, {0x0D, "ori"}, {0x0E, "xori"}, {0x0F, "lui"},
+    {0x20, "lb"}, {0x21, "lh"}, {0x22, "lwl"}, {0x23, "lw"}, {0x24, "lbu"}, {0x25, "lhu"}, {0x26, "lwr"},
+    {0x28, "sb"}, {0x29, "sh"}, {0x2A, "swl"}, {0x2B, "sw"}, {0x2E, "swr"},
+    {0x32, "lwc2"}, {0x3A, "swc2"}
+};
+
+static const OpcodeName SPECIAL_NAMES[] =
+{
+    {0x00, "sll"}, {0x02, "srl"}, {0x03, "sra"}, {0x04, "sllv"}, {0x06, "srlv"}, {0x07, "srav"},
+    {0x08, "jr"}, {0x09, "jalr"}, {0x0C, "syscall"}, {0x0D, "break"},
+    {0x10, "mfhi"}, {0x11, "mthi"}, {0x12, "mflo"}, {0x13, "mtlo"},
+    {0x18, "mult"}, {0x19, "multu"}, {0x1A, "div"}, {0x1B, "divu"},
+    {0x20, "add"}, {0x21, "addu"}, {0x22, "sub"}, {0x23, "subu"},
+    {0x24, "and"}, {0x25, "or"}, {0x26, "xor"}, {0x27, "nor"}, {0x2A, "slt"}, {0x2B, "sltu"}
+};
+
+static const OpcodeName REGIMM_NAMES[] =
+{
+    {0x00, "bltz"}, {0x01, "bgez"}, {0x10, "bltzal"}, {0x11, "bgezal"}
+};
+
+//Only COP0 and the GTE exist on the PSX
+static const OpcodeName COP_NAMES[] =
+{
+    {0x000, "mfc0"}, {0x004, "mtc0"}, {0x010, "rfe"},
+    {0x200, "mfc2"}, {0x202, "cfc2"}, {0x204, "mtc2"}, {0x206, "ctc2"}
+};
+
+static const OpcodeName GTE_NAMES[] =
+{
+    {0x01, "rtps"}, {0x06, "nclip"}, {0x0C, "op"}, {0x10, "dpcs"}, {0x11, "intpl"}, {0x12, "mvmva"},
+    {0x13, "ncds"}, {0x14, "cdp"}, {0x16, "ncdt"}, {0x1B, "nccs"}, {0x1C, "cc"}, {0x1E, "ncs"},
+    {0x20, "nct"}, {0x28, "sqr"}, {0x29, "dcpl"}, {0x2A, "dpct"}, {0x2D, "avsz3"}, {0x2E, "avsz4"},
+    {0x30, "rtpt"}, {0x3D, "gpf"}, {0x3E, "gpl"}, {0x3F, "ncct"}
+};
+
+#define NAME_COUNT(names) (sizeof(names) / sizeof(names[0]))
+
+void OpcodeCounts::clear()
+{
+    memset(this, 0, sizeof(OpcodeCounts));
+}
+
+void OpcodeCounts::add(const OpcodeCounts& other)
+{
+    instructions += other.instructions;
+    for (int i = 0; i < 64; i++)
+    {
+        regular[i] += other.regular[i];
+        special[i] += other.special[i];
+        GTE[i] += other.GTE[i];
+    }
+    for (int i = 0; i < 32; i++)
+    {
+        regimm[i] += other.regimm[i];
+        for (int cop_id = 0; cop_id < 4; cop_id++)
+            cop[cop_id][i] += other.cop[cop_id][i];
+    }
+}
+
+OpcodeStats::OpcodeStats()
+{
+    reset();
+}
+
+void OpcodeStats::reset()
+{
+    frame.clear();
+    last_frame.clear();
+    total.clear();
+    frame_count = 0;
+}
+
+void OpcodeStats::end_frame()
+{
+    last_frame = frame;
+    total.add(frame);
+    frame.clear();
+    frame_count++;
+    if (csv.is_open())
+        write_CSV_row();
+}
+
+bool OpcodeStats::open_CSV(const char* file_name)
+{
+    close_CSV();
+    csv.open(file_name, ios::out | ios::trunc);
+    if (!csv.is_open())
+    {
+        printf("[OpcodeStats] Failed to open %s\n", file_name);
+        return false;
+    }
+    write_CSV_header();
+    return true;
+}
+
+void OpcodeStats::close_CSV()
+{
+    if (csv.is_open())
+        csv.close();
+}
+
+void OpcodeStats::write_CSV_header()
+{
+    csv << "frame,instructions";
+    for (unsigned int i = 0; i < NAME_COUNT(REGULAR_NAMES); i++)
+        csv << "," << REGULAR_NAMES[i].name;
+    for (unsigned int i = 0; i < NAME_COUNT(SPECIAL_NAMES); i++)
+        csv << "," << SPECIAL_NAMES[i].name;
+    for (unsigned int i = 0; i < NAME_COUNT(REGIMM_NAMES); i++)
+        csv << "," << REGIMM_NAMES[i].name;
+    for (unsigned int i = 0; i < NAME_COUNT(COP_NAMES); i++)
+        csv << "," << COP_NAMES[i].name;
+    for (unsigned int i = 0; i < NAME_COUNT(GTE_NAMES); i++)
+        csv << ",gte_" << GTE_NAMES[i].name;
+    csv << "\n";
+}
+
+void OpcodeStats::write_CSV_row()
+{
+    csv << frame_count << "," << last_frame.instructions;
+    for (unsigned int i = 0; i < NAME_COUNT(REGULAR_NAMES); i++)
+        csv << "," << last_frame.regular[REGULAR_NAMES[i].index];
+    for (unsigned int i = 0; i < NAME_COUNT(SPECIAL_NAMES); i++)
+        csv << "," << last_frame.special[SPECIAL_NAMES[i].index];
+    for (unsigned int i = 0; i < NAME_COUNT(REGIMM_NAMES); i++)
+        csv << "," << last_frame.regimm[REGIMM_NAMES[i].index];
+    for (unsigned int i = 0; i < NAME_COUNT(COP_NAMES); i++)
+        csv << "," << last_frame.cop[COP_NAMES[i].index >> 8][COP_NAMES[i].index & 0x1F];
+    for (unsigned int i = 0; i < NAME_COUNT(GTE_NAMES); i++)
+        csv << "," << last_frame.GTE[GTE_NAMES[i].index];
+    csv << "\n";
+}
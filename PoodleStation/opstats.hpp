@@ -0,0 +1,93 @@
+#ifndef OPSTATS_HPP
+#define OPSTATS_HPP
+#include <cstdint>
+#include <fstream>
+
+//Instruction execution counts, for one frame or summed over many
+struct OpcodeCounts
+{
+    uint64_t instructions;
+    uint64_t regular[64]; //By primary opcode (bits 26-31)
+    uint64_t special[64]; //SPECIAL by function field
+    uint64_t regimm[32]; //REGIMM by rt field
+    uint64_t cop[4][32]; //COPn by rs field; all commands land on 0x10
+    uint64_t GTE[64]; //GTE commands by command number
+
+    void clear();
+    void add(const OpcodeCounts& other);
+};
+
+//Counts what the interpreter executes, frame by frame. The CPU only calls count() while stats are enabled,
+//so there is no cost otherwise.
+class OpcodeStats
+{
+    private:
+        OpcodeCounts frame;
+        OpcodeCounts last_frame;
+        OpcodeCounts total;
+        int frame_count;
+
+        std::ofstream csv;
+        void write_CSV_header();
+        void write_CSV_row();
+    public:
+        OpcodeStats();
+
+        void reset();
+        void count(uint32_t instruction);
+        void end_frame();
+
+        //One row per frame, one column per known opcode
+        bool open_CSV(const char* file_name);
+        void close_CSV();
+
+        const OpcodeCounts& get_last_frame();
+        const OpcodeCounts& get_total();
+        int get_frame_count();
+};
+
+inline void OpcodeStats::count(uint32_t instruction)
+{
+    uint32_t op = instruction >> 26;
+    frame.instructions++;
+    frame.regular[op]++;
+    switch (op)
+    {
+        case 0x00:
+            frame.special[instruction & 0x3F]++;
+            break;
+        case 0x01:
+            frame.regimm[(instruction >> 16) & 0x1F]++;
+            break;
+        case 0x10:
+        case 0x11:
+        case 0x12:
+        case 0x13:
+            if (instruction & (1 << 25))
+            {
+                frame.cop[op & 0x3][0x10]++;
+                if (op == 0x12)
+                    frame.GTE[instruction & 0x3F]++;
+            }
+            else
+                frame.cop[op & 0x3][(instruction >> 21) & 0x1F]++;
+            break;
+    }
+}
+
+inline const OpcodeCounts& OpcodeStats::get_last_frame()
+{
+    return last_frame;
+}
+
+inline const OpcodeCounts& OpcodeStats::get_total()
+{
+    return total;
+}
+
+inline int OpcodeStats::get_frame_count()
+{
+    return frame_count;
+}
+
+#endif // OPSTATS_HPP
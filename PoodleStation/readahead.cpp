@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include "readahead.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MADVISE
+#include <sys/mman.h>
+#endif
+
+//Requests are rounded out to whole pages; touching more often than once per page is harmless
+#define PAGE_SIZE_GUESS 4096
+
+using namespace std;
+
+ReadAhead::ReadAhead(DiscImage* disc) : disc(disc)
+{
+    window_start = 0;
+    window_end = 0;
+    jobs_running = 0;
+    stop = false;
+
+#ifdef HAVE_LIBURING
+    //Older kernels (and some sandboxes) refuse io_uring; the threads take over then
+    ring_ready = io_uring_queue_init(READAHEAD_SECTORS, &ring, 0) == 0;
+    ring_in_flight = 0;
+    if (!ring_ready)
+        printf("[ReadAhead] io_uring unavailable, using prefetch threads\n");
+#endif
+}
+
+ReadAhead::~ReadAhead()
+{
+    cancel();
+
+    job_mutex.lock();
+    stop = true;
+    job_mutex.unlock();
+    job_cond.notify_all();
+    for (unsigned int i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+#ifdef HAVE_LIBURING
+    if (ring_ready)
+        io_uring_queue_exit(&ring);
+#endif
+}
+
+void ReadAhead::fault_in(const PrefetchRange& range)
+{
+#ifdef HAVE_MADVISE
+    madvise((void*)range.data, range.length, MADV_WILLNEED);
+#endif
+    volatile uint8_t sink;
+    for (size_t i = 0; i < range.length; i += PAGE_SIZE_GUESS)
+        sink = range.data[i];
+    (void)sink;
+}
+
+void ReadAhead::submit(const uint8_t* data, size_t length)
+{
+    PrefetchRange range;
+    uintptr_t start = (uintptr_t)data & ~(uintptr_t)(PAGE_SIZE_GUESS - 1);
+    range.data = (const uint8_t*)start;
+    range.length = length + ((uintptr_t)data - start);
+
+#ifdef HAVE_LIBURING
+    if (ring_ready)
+    {
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (sqe)
+        {
+            io_uring_prep_madvise(sqe, (void*)range.data, range.length, MADV_WILLNEED);
+            io_uring_submit(&ring);
+            ring_in_flight++;
+            return;
+        }
+    }
+#endif
+
+    unique_lock<mutex> lock(job_mutex);
+    if (workers.empty())
+    {
+        for (int i = 0; i < READAHEAD_THREADS; i++)
+            workers.emplace_back(&ReadAhead::worker_loop, this);
+    }
+    jobs.push_back(range);
+    lock.unlock();
+    job_cond.notify_one();
+}
+
+void ReadAhead::worker_loop()
+{
+    unique_lock<mutex> lock(job_mutex);
+    while (true)
+    {
+        job_cond.wait(lock, [this] { return stop || !jobs.empty(); });
+        if (stop)
+            return;
+
+        PrefetchRange range = jobs.front();
+        jobs.pop_front();
+        jobs_running++;
+        lock.unlock();
+
+        fault_in(range);
+
+        lock.lock();
+        jobs_running--;
+        if (jobs.empty() && !jobs_running)
+            idle_cond.notify_all();
+    }
+}
+
+#ifdef HAVE_LIBURING
+void ReadAhead::reap_completions(bool wait)
+{
+    io_uring_cqe* cqe;
+    while (ring_in_flight && (wait ? io_uring_wait_cqe(&ring, &cqe) : io_uring_peek_cqe(&ring, &cqe)) == 0)
+    {
+        io_uring_cqe_seen(&ring, cqe);
+        ring_in_flight--;
+    }
+}
+#endif
+
+void ReadAhead::prefetch(int32_t lba)
+{
+#ifdef HAVE_LIBURING
+    if (ring_ready)
+        reap_completions(false);
+#endif
+
+    //Sequential reads only need the sectors that just came into the window
+    int32_t from = (lba >= window_start && lba <= window_end) ? window_end : lba;
+    int32_t end = min(lba + READAHEAD_SECTORS, disc->get_end());
+    window_start = lba;
+    window_end = max(from, end);
+
+    //Sectors that follow each other in their file go out as one request
+    const uint8_t* run = nullptr;
+    size_t run_length = 0;
+    for (int32_t sector = max(from, 0); sector < end; sector++)
+    {
+        int size;
+        const uint8_t* data = disc->get_mapped_sector(sector, size);
+        if (data && run && data == run + run_length)
+        {
+            run_length += size;
+            continue;
+        }
+        if (run)
+            submit(run, run_length);
+        run = data;
+        run_length = data ? size : 0;
+    }
+    if (run)
+        submit(run, run_length);
+}
+
+void ReadAhead::cancel()
+{
+    unique_lock<mutex> lock(job_mutex);
+    jobs.clear();
+    idle_cond.wait(lock, [this] { return !jobs_running; });
+    lock.unlock();
+
+#ifdef HAVE_LIBURING
+    if (ring_ready)
+        reap_completions(true);
+#endif
+
+    window_start = 0;
+    window_end = 0;
+}
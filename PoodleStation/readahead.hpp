@@ -0,0 +1,67 @@
+#ifndef READAHEAD_HPP
+#define READAHEAD_HPP
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "discimage.hpp"
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+//How far ahead of the drive the image's pages are brought in
+#define READAHEAD_SECTORS 32
+#define READAHEAD_THREADS 2
+
+struct PrefetchRange
+{
+    const uint8_t* data;
+    size_t length;
+};
+
+//Faults in the mapped pages of the sectors following the drive's position in the background, so streaming
+//doesn't hit the disk on the emulation thread. Sectors are still read straight from the mapping; this only
+//makes sure their pages are there by the time the drive gets to them, and never holds the drive up.
+//Requests go to io_uring as asynchronous madvise where it's built in and the kernel supports it, and to a
+//few threads that touch the pages otherwise.
+class ReadAhead
+{
+    private:
+        DiscImage* disc;
+
+        //Sectors [window_start, window_end) have already been asked for
+        int32_t window_start, window_end;
+
+#ifdef HAVE_LIBURING
+        io_uring ring;
+        bool ring_ready;
+        int ring_in_flight;
+        void reap_completions(bool wait);
+#endif
+
+        std::vector<std::thread> workers;
+        std::deque<PrefetchRange> jobs;
+        std::mutex job_mutex;
+        std::condition_variable job_cond;
+        std::condition_variable idle_cond;
+        int jobs_running;
+        bool stop;
+
+        void submit(const uint8_t* data, size_t length);
+        void worker_loop();
+        static void fault_in(const PrefetchRange& range);
+    public:
+        ReadAhead(DiscImage* disc);
+        ~ReadAhead();
+
+        //Starts bringing in the window of sectors from lba on, skipping ones already asked for
+        void prefetch(int32_t lba);
+
+        //Waits for outstanding work and forgets the window, so the image can be closed
+        void cancel();
+};
+
+#endif // READAHEAD_HPP
@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <cstring>
+#include "scanout.hpp"
+
+//SSE2 is part of x86-64, so it's used whenever the compiler targets it. Wider kernels are built with per-function
+//target attributes and picked at runtime, so a default build still uses them on CPUs that have them.
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SCANOUT_DISPATCH
+#include <immintrin.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef void (*Scanout15Kernel)(uint32_t* dest, const uint16_t* source, int count);
+typedef void (*Scanout24Kernel)(uint32_t* dest, const uint8_t* line, uint32_t offset, int count);
+
+static void scanout_15bit_scalar(uint32_t* dest, const uint16_t* source, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t color = source[i];
+        uint32_t final_color = 0xFF000000;
+        final_color |= (color & 0x1F) << 3;
+        final_color |= ((color >> 5) & 0x1F) << 11;
+        final_color |= ((color >> 10) & 0x1F) << 19;
+        dest[i] = final_color;
+    }
+}
+
+static void scanout_24bit_scalar(uint32_t* dest, const uint8_t* line, uint32_t offset, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t final_color = 0xFF000000;
+        final_color |= line[offset & 0x7FF];
+        final_color |= line[(offset + 1) & 0x7FF] << 8;
+        final_color |= line[(offset + 2) & 0x7FF] << 16;
+        dest[i] = final_color;
+        offset += 3;
+    }
+}
+
+#ifdef __SSE2__
+//Builds 8 output pixels' worth of halves: the low one holds red and green, the high one blue and alpha
+static inline void split_15bit(__m128i colors, __m128i& rg, __m128i& ba)
+{
+    rg = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(colors, 3), _mm_set1_epi16(0x00F8)),
+                      _mm_and_si128(_mm_slli_epi16(colors, 6), _mm_set1_epi16((short)0xF800)));
+    ba = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(colors, 7), _mm_set1_epi16(0x00F8)),
+                      _mm_set1_epi16((short)0xFF00));
+}
+
+static inline int scanout_15bit_sse2_run(uint32_t* dest, const uint16_t* source, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i rg, ba;
+        split_15bit(_mm_loadu_si128((const __m128i*)&source[i]), rg, ba);
+        _mm_storeu_si128((__m128i*)&dest[i], _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)&dest[i + 4], _mm_unpackhi_epi16(rg, ba));
+    }
+    return i;
+}
+
+static void scanout_15bit_sse2(uint32_t* dest, const uint16_t* source, int count)
+{
+    int i = scanout_15bit_sse2_run(dest, source, count);
+    scanout_15bit_scalar(&dest[i], &source[i], count - i);
+}
+#endif
+
+#ifdef SCANOUT_DISPATCH
+TARGET_AVX2 static void scanout_15bit_avx2(uint32_t* dest, const uint16_t* source, int count)
+{
+    int i = 0;
+    const __m256i red_mask = _mm256_set1_epi16(0x00F8);
+    const __m256i green_mask = _mm256_set1_epi16((short)0xF800);
+    const __m256i alpha = _mm256_set1_epi16((short)0xFF00);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i colors = _mm256_loadu_si256((const __m256i*)&source[i]);
+        __m256i rg = _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(colors, 3), red_mask),
+                                     _mm256_and_si256(_mm256_slli_epi16(colors, 6), green_mask));
+        __m256i ba = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(colors, 7), red_mask), alpha);
+
+        //Unpacking works within 128-bit lanes, so the halves come out as pixels 0-3/8-11 and 4-7/12-15
+        __m256i lo = _mm256_unpacklo_epi16(rg, ba);
+        __m256i hi = _mm256_unpackhi_epi16(rg, ba);
+        _mm256_storeu_si256((__m256i*)&dest[i], _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)&dest[i + 8], _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    i += scanout_15bit_sse2_run(&dest[i], &source[i], count - i);
+    scanout_15bit_scalar(&dest[i], &source[i], count - i);
+}
+
+//Spreads 4 packed RGB triplets out to 4 pixels at a time. 16 bytes are loaded, so it stays clear of the end
+//of the line and leaves the rest to the scalar loop. Returns the number of pixels converted.
+TARGET_SSSE3 static inline int scanout_24bit_ssse3_run(uint32_t* dest, const uint8_t* line, uint32_t& offset, int count)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+    int i = 0;
+    for (; i + 4 <= count && offset + 16 <= 2048; i += 4)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)&line[offset]);
+        _mm_storeu_si128((__m128i*)&dest[i], _mm_or_si128(_mm_shuffle_epi8(bytes, shuffle), alpha));
+        offset += 12;
+    }
+    return i;
+}
+
+TARGET_SSSE3 static void scanout_24bit_ssse3(uint32_t* dest, const uint8_t* line, uint32_t offset, int count)
+{
+    int i = scanout_24bit_ssse3_run(dest, line, offset, count);
+    scanout_24bit_scalar(&dest[i], line, offset, count - i);
+}
+
+TARGET_AVX2 static void scanout_24bit_avx2(uint32_t* dest, const uint8_t* line, uint32_t offset, int count)
+{
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                             0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+    int i = 0;
+    for (; i + 8 <= count && offset + 28 <= 2048; i += 8)
+    {
+        __m256i bytes = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)&line[offset]));
+        bytes = _mm256_inserti128_si256(bytes, _mm_loadu_si128((const __m128i*)&line[offset + 12]), 1);
+        _mm256_storeu_si256((__m256i*)&dest[i], _mm256_or_si256(_mm256_shuffle_epi8(bytes, shuffle), alpha));
+        offset += 24;
+    }
+    i += scanout_24bit_ssse3_run(&dest[i], line, offset, count - i);
+    scanout_24bit_scalar(&dest[i], line, offset, count - i);
+}
+#endif
+
+//Baseline kernels until ScanoutStage has checked what the CPU supports
+#ifdef __SSE2__
+static Scanout15Kernel scanout_15bit_kernel = scanout_15bit_sse2;
+#else
+static Scanout15Kernel scanout_15bit_kernel = scanout_15bit_scalar;
+#endif
+static Scanout24Kernel scanout_24bit_kernel = scanout_24bit_scalar;
+
+static void select_scanout_kernels()
+{
+#ifdef SCANOUT_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scanout_15bit_kernel = scanout_15bit_avx2;
+        scanout_24bit_kernel = scanout_24bit_avx2;
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+        scanout_24bit_kernel = scanout_24bit_ssse3;
+#endif
+}
+
+void scanout_15bit(uint32_t* dest, const uint16_t* source, int count)
+{
+    scanout_15bit_kernel(dest, source, count);
+}
+
+void scanout_24bit(uint32_t* dest, const uint8_t* line, uint32_t offset, int count)
+{
+    scanout_24bit_kernel(dest, line, offset & 0x7FF, count);
+}
+
+ScanoutStage::ScanoutStage() : target_w(0), target_h(0), scale_mode(SCALE_NONE)
+{
+    snapshots = new DisplaySnapshot[2];
+    next_snapshot = 0;
+    pending = -1;
+    working = -1;
+    stop = false;
+    frame_w = 0;
+    frame_h = 0;
+    mailbox = nullptr;
+    select_scanout_kernels();
+    thread = std::thread(&ScanoutStage::loop, this);
+}
+
+ScanoutStage::~ScanoutStage()
+{
+    {
+        std::lock_guard<std::mutex> lock(stage_mutex);
+        stop = true;
+    }
+    wake.notify_one();
+    thread.join();
+    delete[] snapshots;
+}
+
+void ScanoutStage::set_frame_output(FrameMailbox* mailbox, std::function<void()> frame_ready)
+{
+    std::lock_guard<std::mutex> lock(stage_mutex);
+    this->mailbox = mailbox;
+    this->frame_ready = frame_ready;
+}
+
+void ScanoutStage::set_output_size(int w, int h)
+{
+    target_w.store(w);
+    target_h.store(h);
+}
+
+void ScanoutStage::set_scale_mode(SCALE_MODE mode)
+{
+    scale_mode.store(mode);
+}
+
+DisplaySnapshot& ScanoutStage::begin_frame()
+{
+    std::unique_lock<std::mutex> lock(stage_mutex);
+    idle.wait(lock, [this] { return pending != next_snapshot && working != next_snapshot; });
+    return snapshots[next_snapshot];
+}
+
+void ScanoutStage::submit()
+{
+    {
+        std::unique_lock<std::mutex> lock(stage_mutex);
+        //The previous frame has to be picked up first, or its changed lines would be lost
+        idle.wait(lock, [this] { return pending == -1; });
+        pending = next_snapshot;
+        next_snapshot ^= 1;
+    }
+    wake.notify_one();
+}
+
+void ScanoutStage::finish()
+{
+    std::unique_lock<std::mutex> lock(stage_mutex);
+    idle.wait(lock, [this] { return pending == -1 && working == -1; });
+}
+
+void ScanoutStage::loop()
+{
+    while (true)
+    {
+        FrameMailbox* mailbox;
+        std::function<void()> frame_ready;
+        {
+            std::unique_lock<std::mutex> lock(stage_mutex);
+            wake.wait(lock, [this] { return pending != -1 || stop; });
+            if (stop)
+                return;
+            working = pending;
+            pending = -1;
+            mailbox = this->mailbox;
+            frame_ready = this->frame_ready;
+        }
+        idle.notify_all();
+
+        convert(snapshots[working]);
+
+        if (mailbox)
+        {
+            int w = frame_w, h = frame_h;
+            int out_w = target_w.load(), out_h = target_h.load();
+            int mode = scale_mode.load();
+            if (out_w <= 0 || out_h <= 0)
+                mode = SCALE_NONE;
+
+            uint32_t* buffer;
+            switch (mode)
+            {
+                case SCALE_INTEGER:
+                {
+                    int factor = std::max(1, std::min(out_w / w, out_h / h));
+                    buffer = mailbox->begin_write(w * factor, h * factor);
+                    scale_integer(buffer, factor);
+                    break;
+                }
+                case SCALE_BILINEAR:
+                    buffer = mailbox->begin_write(out_w, out_h);
+                    scale_bilinear(buffer, out_w, out_h);
+                    break;
+                default:
+                    buffer = mailbox->begin_write(w, h);
+                    memcpy(buffer, frame.data(), w * h * sizeof(uint32_t));
+                    break;
+            }
+            mailbox->publish();
+            if (frame_ready)
+                frame_ready();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stage_mutex);
+            working = -1;
+        }
+        idle.notify_all();
+    }
+}
+
+void ScanoutStage::convert(const DisplaySnapshot& snapshot)
+{
+    if (snapshot.w != frame_w || snapshot.h != frame_h)
+    {
+        frame_w = snapshot.w;
+        frame_h = snapshot.h;
+        frame.assign(frame_w * frame_h, 0xFF000000);
+    }
+
+    //A full redraw captured every line whole, so there are no dirty bits to check
+    for (int y = 0; y < frame_h; y++)
+    {
+        uint16_t dirty = snapshot.dirty[y];
+        if (!snapshot.full && !dirty)
+            continue;
+
+        uint32_t* row = &frame[y * frame_w];
+        if (!snapshot.enabled)
+            std::fill(row, row + frame_w, 0xFF000000);
+        else if (snapshot.color_24bit)
+            scanout_24bit(row, snapshot.lines[y], 0, frame_w);
+        else if (snapshot.full)
+            scanout_15bit(row, (const uint16_t*)snapshot.lines[y], frame_w);
+        else
+        {
+            //Spans end on 64 pixel VRAM block boundaries so each one has a single dirty bit
+            const uint16_t* line = (const uint16_t*)snapshot.lines[y];
+            int x = 0;
+            while (x < frame_w)
+            {
+                uint32_t pix_x = (snapshot.start_x + x) & 0x3FF;
+                int len = std::min(64 - (int)(pix_x & 0x3F), frame_w - x);
+                if (dirty & (1 << (pix_x >> 6)))
+                    scanout_15bit(&row[x], &line[x], len);
+                x += len;
+            }
+        }
+    }
+}
+
+void ScanoutStage::scale_integer(uint32_t* dest, int factor)
+{
+    int dest_w = frame_w * factor;
+    for (int y = 0; y < frame_h; y++)
+    {
+        const uint32_t* row = &frame[y * frame_w];
+        uint32_t* dest_row = &dest[(y * factor) * dest_w];
+        for (int x = 0; x < frame_w; x++)
+            std::fill(dest_row + (x * factor), dest_row + ((x + 1) * factor), row[x]);
+        for (int i = 1; i < factor; i++)
+            memcpy(dest_row + (i * dest_w), dest_row, dest_w * sizeof(uint32_t));
+    }
+}
+
+//Blends two pixels with an 8-bit weight, two channels at a time
+static inline uint32_t lerp_pixel(uint32_t a, uint32_t b, uint32_t weight)
+{
+    uint32_t rb = (((a & 0x00FF00FF) * (256 - weight)) + ((b & 0x00FF00FF) * weight)) >> 8;
+    uint32_t ga = ((((a >> 8) & 0x00FF00FF) * (256 - weight)) + (((b >> 8) & 0x00FF00FF) * weight));
+    return (rb & 0x00FF00FF) | (ga & 0xFF00FF00);
+}
+
+//Maps the center of each destination pixel back onto the source, in 16.16 fixed point
+static void bilinear_steps(int src_size, int dest_size, std::vector<int>& index, std::vector<uint8_t>& weight)
+{
+    index.resize(dest_size);
+    weight.resize(dest_size);
+    for (int i = 0; i < dest_size; i++)
+    {
+        int64_t pos = ((((int64_t)i * 2) + 1) * src_size * 0x8000) / dest_size - 0x8000;
+        pos = std::max((int64_t)0, std::min(pos, (int64_t)(src_size - 1) << 16));
+        index[i] = pos >> 16;
+        weight[i] = (pos >> 8) & 0xFF;
+    }
+}
+
+void ScanoutStage::scale_bilinear(uint32_t* dest, int dest_w, int dest_h)
+{
+    std::vector<int> x_index, y_index;
+    std::vector<uint8_t> x_weight, y_weight;
+    bilinear_steps(frame_w, dest_w, x_index, x_weight);
+    bilinear_steps(frame_h, dest_h, y_index, y_weight);
+
+    for (int y = 0; y < dest_h; y++)
+    {
+        const uint32_t* row0 = &frame[y_index[y] * frame_w];
+        const uint32_t* row1 = &frame[std::min(y_index[y] + 1, frame_h - 1) * frame_w];
+        uint32_t* dest_row = &dest[y * dest_w];
+        for (int x = 0; x < dest_w; x++)
+        {
+            int x0 = x_index[x];
+            int x1 = std::min(x0 + 1, frame_w - 1);
+            uint32_t top = lerp_pixel(row0[x0], row0[x1], x_weight[x]);
+            uint32_t bottom = lerp_pixel(row1[x0], row1[x1], x_weight[x]);
+            dest_row[x] = lerp_pixel(top, bottom, y_weight[y]);
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef SCANOUT_HPP
+#define SCANOUT_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "framemailbox.hpp"
+
+//Largest display area: 640 pixels wide, 576 lines for interlaced PAL
+#define MAX_DISPLAY_W 640
+#define MAX_DISPLAY_H 576
+
+enum SCALE_MODE
+{
+    SCALE_NONE, //Native resolution, left for the frontend to stretch
+    SCALE_INTEGER, //Largest whole multiple that fits the output size
+    SCALE_BILINEAR //Filtered to exactly the output size
+};
+
+//Display lines captured at VBLANK, unwrapped from VRAM
+struct DisplaySnapshot
+{
+    int w, h;
+    bool enabled;
+    bool color_24bit;
+    bool full; //Every line was captured, e.g. after a mode change
+    uint16_t start_x; //VRAM x of the first pixel, which the dirty bits are aligned to
+
+    //VRAM block columns that changed on each line; lines with no bits set weren't captured
+    uint16_t dirty[MAX_DISPLAY_H];
+    uint8_t lines[MAX_DISPLAY_H][2048];
+};
+
+//Display line converters to the RGBA8888 layout the frontend presents.
+//The widest kernels the CPU supports (AVX2, SSSE3, SSE2) are picked when the first ScanoutStage is created,
+//with scalar fallbacks.
+
+//15-bit BGR555 pixels, one per halfword
+void scanout_15bit(uint32_t* dest, const uint16_t* source, int count);
+
+//24-bit pixels packed as R, G, B bytes. offset is in bytes into a 2048 byte VRAM line and wraps around it.
+void scanout_24bit(uint32_t* dest, const uint8_t* line, uint32_t offset, int count);
+
+//Converts and scales display snapshots on its own thread while the emulator runs the next frame.
+//The GPU fills one snapshot while the other is being worked on.
+class ScanoutStage
+{
+    private:
+        DisplaySnapshot* snapshots;
+        int next_snapshot;
+        int pending; //Snapshot waiting to be picked up, or -1
+        int working; //Snapshot being converted, or -1
+
+        std::thread thread;
+        std::mutex stage_mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        bool stop;
+
+        //Display area at native resolution, kept between frames so only changed lines need converting
+        std::vector<uint32_t> frame;
+        int frame_w, frame_h;
+
+        FrameMailbox* mailbox;
+
+        std::atomic<int> target_w, target_h;
+        std::atomic<int> scale_mode;
+        std::function<void()> frame_ready;
+
+        void loop();
+        void convert(const DisplaySnapshot& snapshot);
+        void scale_integer(uint32_t* dest, int factor);
+        void scale_bilinear(uint32_t* dest, int dest_w, int dest_h);
+    public:
+        ScanoutStage();
+        ~ScanoutStage();
+
+        //Finished frames go into mailbox, after which frame_ready is called from the scan-out thread
+        void set_frame_output(FrameMailbox* mailbox, std::function<void()> frame_ready);
+        void set_output_size(int w, int h);
+        void set_scale_mode(SCALE_MODE mode);
+
+        //Waits until the next snapshot is free to fill
+        DisplaySnapshot& begin_frame();
+        void submit();
+        void finish();
+};
+
+#endif // SCANOUT_HPP
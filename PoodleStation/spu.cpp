@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "spu.hpp"
+
+using namespace std;
+
+//Register offsets from 1F801C00
+#define SPU_TRANSFER_ADDR 0x1A6
+#define SPU_TRANSFER_FIFO 0x1A8
+#define SPU_CNT 0x1AA
+#define SPU_STAT 0x1AE
+
+//SPUCNT bits 4-5
+#define TRANSFER_STOP 0
+#define TRANSFER_MANUAL 1
+#define TRANSFER_DMA_WRITE 2
+#define TRANSFER_DMA_READ 3
+
+SPU::SPU()
+{
+    RAM = new uint8_t[SPU_RAM_SIZE];
+}
+
+SPU::~SPU()
+{
+    delete[] RAM;
+}
+
+void SPU::reset()
+{
+    memset(RAM, 0, SPU_RAM_SIZE);
+    memset(regs, 0, sizeof(regs));
+    transfer_addr = 0;
+    FIFO_size = 0;
+}
+
+void SPU::flush_FIFO()
+{
+    for (int i = 0; i < FIFO_size; i++)
+    {
+        *(uint16_t*)&RAM[transfer_addr] = FIFO[i];
+        transfer_addr = (transfer_addr + 2) & (SPU_RAM_SIZE - 1);
+    }
+    FIFO_size = 0;
+}
+
+void SPU::write_block(const uint8_t* source, int bytes)
+{
+    //Sound RAM wraps, so a block may have to be split in two
+    while (bytes > 0)
+    {
+        int chunk = min(bytes, (int)(SPU_RAM_SIZE - transfer_addr));
+        memcpy(&RAM[transfer_addr], source, chunk);
+        transfer_addr = (transfer_addr + chunk) & (SPU_RAM_SIZE - 1);
+        source += chunk;
+        bytes -= chunk;
+    }
+}
+
+void SPU::read_block(uint8_t* dest, int bytes)
+{
+    while (bytes > 0)
+    {
+        int chunk = min(bytes, (int)(SPU_RAM_SIZE - transfer_addr));
+        memcpy(dest, &RAM[transfer_addr], chunk);
+        transfer_addr = (transfer_addr + chunk) & (SPU_RAM_SIZE - 1);
+        dest += chunk;
+        bytes -= chunk;
+    }
+}
+
+uint16_t SPU::read16(uint32_t addr)
+{
+    uint32_t reg = (addr & 0x3FF) >> 1;
+    switch (reg << 1)
+    {
+        case SPU_STAT:
+        {
+            //Transfers finish instantly, so the busy flag never shows
+            uint16_t cnt = regs[SPU_CNT >> 1];
+            uint16_t stat = cnt & 0x3F;
+            int mode = (cnt >> 4) & 0x3;
+            stat |= (cnt & (1 << 5)) << 2;
+            stat |= (mode == TRANSFER_DMA_WRITE) << 8;
+            stat |= (mode == TRANSFER_DMA_READ) << 9;
+            return stat;
+        }
+        default:
+            return regs[reg];
+    }
+}
+
+void SPU::write16(uint32_t addr, uint16_t value)
+{
+    uint32_t reg = (addr & 0x3FF) >> 1;
+    regs[reg] = value;
+    switch (reg << 1)
+    {
+        case SPU_TRANSFER_ADDR:
+            //In units of eight bytes
+            transfer_addr = (value << 3) & (SPU_RAM_SIZE - 1);
+            break;
+        case SPU_TRANSFER_FIFO:
+            if (FIFO_size < 32)
+            {
+                FIFO[FIFO_size] = value;
+                FIFO_size++;
+            }
+            else
+                printf("[SPU] Transfer FIFO overflow\n");
+            break;
+        case SPU_CNT:
+            if (((value >> 4) & 0x3) == TRANSFER_MANUAL)
+                flush_FIFO();
+            break;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef SPU_HPP
+#define SPU_HPP
+#include <cstdint>
+
+#define SPU_RAM_SIZE (1024 * 512)
+
+//Registers and sound RAM only for now; nothing is mixed or played yet
+class SPU
+{
+    private:
+        uint8_t* RAM;
+
+        //Raw register file for 1F801C00-1F801FFF, by halfword
+        uint16_t regs[0x200];
+
+        uint32_t transfer_addr;
+
+        //Manual writes queue up here until the transfer mode is set to manual write
+        uint16_t FIFO[32];
+        int FIFO_size;
+
+        void flush_FIFO();
+    public:
+        SPU();
+        ~SPU();
+
+        void reset();
+
+        uint16_t read16(uint32_t addr);
+        void write16(uint32_t addr, uint16_t value);
+
+        //DMA channel 4, moving whole blocks between main RAM and sound RAM
+        void write_block(const uint8_t* source, int bytes);
+        void read_block(uint8_t* dest, int bytes);
+};
+
+#endif // SPU_HPP
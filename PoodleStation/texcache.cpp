@@ -0,0 +1,137 @@
+#include <cstring>
+#include "texcache.hpp"
+
+TextureCache::TextureCache()
+{
+    VRAM = nullptr;
+    entries = nullptr;
+}
+
+TextureCache::~TextureCache()
+{
+    if (entries)
+        delete[] entries;
+}
+
+void TextureCache::reset(uint8_t* VRAM)
+{
+    this->VRAM = VRAM;
+    if (!entries)
+        entries = new TexCacheEntry[TEXCACHE_ENTRIES];
+    for (int i = 0; i < TEXCACHE_ENTRIES; i++)
+        entries[i].valid = false;
+    memset(dirty, 0, sizeof(dirty));
+    any_dirty = false;
+    use_counter = 0;
+}
+
+void TextureCache::mark_blocks(uint16_t* blocks, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    if (!w || !h)
+        return;
+
+    //Regions wrap around the edges of VRAM
+    uint32_t columns = 0;
+    uint32_t col_count = ((x & 0x3F) + w + 63) / 64;
+    if (col_count >= 16)
+        columns = 0xFFFF;
+    else
+    {
+        for (uint32_t i = 0; i < col_count; i++)
+            columns |= 1 << (((x >> 6) + i) & 0xF);
+    }
+
+    uint32_t row_count = ((y & 0xF) + h + 15) / 16;
+    if (row_count > TEXCACHE_BLOCK_ROWS)
+        row_count = TEXCACHE_BLOCK_ROWS;
+    for (uint32_t i = 0; i < row_count; i++)
+        blocks[((y >> 4) + i) & 0x1F] |= columns;
+}
+
+void TextureCache::invalidate(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    mark_blocks(dirty, x, y, w, h);
+    any_dirty = true;
+}
+
+void TextureCache::flush_dirty()
+{
+    for (int i = 0; i < TEXCACHE_ENTRIES; i++)
+    {
+        if (!entries[i].valid)
+            continue;
+        for (int row = 0; row < TEXCACHE_BLOCK_ROWS; row++)
+        {
+            if (entries[i].blocks[row] & dirty[row])
+            {
+                entries[i].valid = false;
+                break;
+            }
+        }
+    }
+    memset(dirty, 0, sizeof(dirty));
+    any_dirty = false;
+}
+
+void TextureCache::decode(TexCacheEntry& entry, uint32_t texpage_x, uint32_t texpage_y, uint16_t palette, uint8_t color_depth)
+{
+    uint16_t* VRAM16 = (uint16_t*)VRAM;
+    uint32_t page_x = texpage_x * 64;
+    uint32_t clut_x = (palette & 0x3F) * 16;
+    uint32_t clut_y = (palette >> 6) & 0x1FF;
+    int clut_size = (color_depth == 0) ? 16 : 256;
+
+    uint16_t clut[256];
+    for (int i = 0; i < clut_size; i++)
+        clut[i] = VRAM16[((clut_x + i) & 0x3FF) + (clut_y * 1024)];
+
+    for (int t = 0; t < 256; t++)
+    {
+        uint16_t* row = &VRAM16[((texpage_y + t) & 0x1FF) * 1024];
+        uint16_t* dest = &entry.texels[t * 256];
+        if (color_depth == 0)
+        {
+            for (int s = 0; s < 256; s++)
+                dest[s] = clut[(row[(page_x + (s >> 2)) & 0x3FF] >> ((s & 0x3) * 4)) & 0xF];
+        }
+        else
+        {
+            for (int s = 0; s < 256; s++)
+                dest[s] = clut[(row[(page_x + (s >> 1)) & 0x3FF] >> ((s & 0x1) * 8)) & 0xFF];
+        }
+    }
+
+    memset(entry.blocks, 0, sizeof(entry.blocks));
+    mark_blocks(entry.blocks, page_x, texpage_y, (color_depth == 0) ? 64 : 128, 256);
+    mark_blocks(entry.blocks, clut_x, clut_y, clut_size, 1);
+}
+
+const uint16_t* TextureCache::get_page(uint32_t texpage_x, uint32_t texpage_y, uint16_t palette, uint8_t color_depth)
+{
+    if (any_dirty)
+        flush_dirty();
+
+    uint32_t key = (texpage_x & 0xF) | (((texpage_y >> 8) & 0x1) << 4) | ((color_depth & 0x3) << 5) | (palette << 7);
+    use_counter++;
+
+    TexCacheEntry* victim = &entries[0];
+    for (int i = 0; i < TEXCACHE_ENTRIES; i++)
+    {
+        TexCacheEntry* entry = &entries[i];
+        if (entry->valid && entry->key == key)
+        {
+            entry->last_used = use_counter;
+            return entry->texels;
+        }
+        if (!entry->valid)
+            victim = entry;
+        else if (victim->valid && entry->last_used < victim->last_used)
+            victim = entry;
+    }
+
+    decode(*victim, texpage_x & 0xF, texpage_y & 0x100, palette, color_depth);
+    victim->valid = true;
+    victim->key = key;
+    victim->last_used = use_counter;
+    return victim->texels;
+}
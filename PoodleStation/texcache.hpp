@@ -0,0 +1,45 @@
+#ifndef TEXCACHE_HPP
+#define TEXCACHE_HPP
+#include <cstdint>
+
+//VRAM is tracked in blocks of 64x16 halfwords, so a texture page spans one to four block columns
+#define TEXCACHE_BLOCK_ROWS 32
+#define TEXCACHE_ENTRIES 16
+
+struct TexCacheEntry
+{
+    bool valid;
+    uint32_t key;
+    uint32_t last_used;
+
+    //Bitmask of block columns per block row that the page and its CLUT were decoded from
+    uint16_t blocks[TEXCACHE_BLOCK_ROWS];
+
+    uint16_t texels[256 * 256];
+};
+
+class TextureCache
+{
+    private:
+        uint8_t* VRAM;
+        TexCacheEntry* entries;
+        uint16_t dirty[TEXCACHE_BLOCK_ROWS];
+        bool any_dirty;
+        uint32_t use_counter;
+
+        void flush_dirty();
+        void decode(TexCacheEntry& entry, uint32_t texpage_x, uint32_t texpage_y, uint16_t palette, uint8_t color_depth);
+    public:
+        TextureCache();
+        ~TextureCache();
+
+        static void mark_blocks(uint16_t* blocks, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+        void reset(uint8_t* VRAM);
+
+        void invalidate(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+        const uint16_t* get_page(uint32_t texpage_x, uint32_t texpage_y, uint16_t palette, uint8_t color_depth);
+};
+
+#endif // TEXCACHE_HPP
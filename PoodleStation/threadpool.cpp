@@ -0,0 +1,134 @@
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool() : queue_count(0), jobs_left(0), generation(0), stop(false)
+{
+
+}
+
+ThreadPool::~ThreadPool()
+{
+    shutdown();
+}
+
+void ThreadPool::start(int thread_count)
+{
+    shutdown();
+    if (thread_count < 1)
+        thread_count = 1;
+
+    //Queue 0 belongs to whichever thread calls parallel_for
+    queue_count = thread_count + 1;
+    queues.reset(new WorkQueue[queue_count]);
+    stop = false;
+    for (int i = 1; i < queue_count; i++)
+        workers.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+}
+
+void ThreadPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        stop = true;
+    }
+    start_cond.notify_all();
+    for (unsigned int i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.clear();
+    queue_count = 0;
+}
+
+int ThreadPool::size()
+{
+    return queue_count;
+}
+
+bool ThreadPool::get_job(int queue, int& index)
+{
+    //Own queue first, newest job first to stay cache-warm
+    {
+        WorkQueue& own = queues[queue];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (!own.jobs.empty())
+        {
+            index = own.jobs.back();
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+
+    //Steal the oldest job from someone else
+    for (int i = 1; i < queue_count; i++)
+    {
+        WorkQueue& victim = queues[(queue + i) % queue_count];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            index = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run_jobs(int queue)
+{
+    int index;
+    while (get_job(queue, index))
+    {
+        job(index);
+        if (jobs_left.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            done_cond.notify_all();
+        }
+    }
+}
+
+void ThreadPool::worker_loop(int queue)
+{
+    uint32_t seen_generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            start_cond.wait(lock, [&] { return stop || generation != seen_generation; });
+            if (stop)
+                return;
+            seen_generation = generation;
+        }
+        run_jobs(queue);
+    }
+}
+
+void ThreadPool::parallel_for(int count, const std::function<void(int)>& job)
+{
+    if (count <= 0)
+        return;
+    if (queue_count <= 1)
+    {
+        for (int i = 0; i < count; i++)
+            job(i);
+        return;
+    }
+
+    this->job = job;
+    jobs_left.store(count);
+    for (int i = 0; i < count; i++)
+    {
+        WorkQueue& queue = queues[i % queue_count];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.jobs.push_back(i);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        generation++;
+    }
+    start_cond.notify_all();
+
+    run_jobs(0);
+
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    done_cond.wait(lock, [this] { return jobs_left.load() == 0; });
+}
@@ -0,0 +1,51 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkQueue
+{
+    std::mutex lock;
+    std::deque<int> jobs;
+};
+
+//Fixed set of workers for fork/join loops. Every worker owns a queue of job indices and steals from the
+//others once its own runs dry, so uneven jobs (e.g. busy and empty screen tiles) still balance out.
+class ThreadPool
+{
+    private:
+        std::vector<std::thread> workers;
+        std::unique_ptr<WorkQueue[]> queues;
+        int queue_count;
+
+        std::function<void(int)> job;
+        std::atomic<int> jobs_left;
+
+        std::mutex pool_mutex;
+        std::condition_variable start_cond;
+        std::condition_variable done_cond;
+        uint32_t generation;
+        bool stop;
+
+        bool get_job(int queue, int& index);
+        void run_jobs(int queue);
+        void worker_loop(int queue);
+    public:
+        ThreadPool();
+        ~ThreadPool();
+
+        void start(int thread_count);
+        void shutdown();
+        int size();
+
+        //Runs job(0) ... job(count - 1) across the pool; the calling thread helps out and returns once all are done
+        void parallel_for(int count, const std::function<void(int)>& job);
+};
+
+#endif // THREADPOOL_HPP